@@ -0,0 +1,299 @@
+// Throughput and latency benchmark of the logical volume.
+//
+//   g++ -O2 -o bench bench.cc -lpthread
+//   ./bench [--quick] [--full] [--json] [--seconds S] [--warmup S] [--dir PATH]
+//           [--baseline FILE] [--tolerance F]
+//
+// Every configuration starts from a new array whose working set was written
+// once, runs the workload for the warmup without recording, then records the
+// latency of every operation for the measured time. One line per configuration
+// goes to stdout, CSV by default or JSON with --json; progress goes to stderr.
+// By default each axis is swept with the others at the baseline, --full runs
+// every combination. With --baseline, the results are compared to an earlier
+// CSV run and the exit status is 1 if any configuration lost more than
+// --tolerance of its MB/s or gained as much on its p99.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "include/RAID6.hpp"
+
+using namespace std;
+
+struct Config {
+    int disks = 6;
+    int block_size = 4096;
+    size_t io_size = 64 * 1024;
+    int read_pct = 50;  // share of operations that are reads
+    bool random = true; // random or sequential positions
+    int threads = 1;
+    int degraded = 0;   // failed disks, 0 to 2
+};
+
+struct Result {
+    size_t ops = 0;
+    size_t errors = 0;
+    double seconds = 0;
+    double mb_per_sec = 0;
+    double iops = 0;
+    double mean_us = 0;
+    double p50_us = 0;
+    double p99_us = 0;
+    double p999_us = 0;
+};
+
+struct Settings {
+    double seconds = 1.0;
+    double warmup = 0.25;
+    size_t working_set = 64 << 20;
+    string dir = "data_bench/";
+    bool full = false;
+    bool json = false;
+    string baseline;
+    double tolerance = 0.1;
+};
+
+// nearest rank of a sorted sample
+double percentile(const vector<int64_t> &sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    size_t rank = (size_t)ceil(p * sorted.size());
+    return sorted[min(sorted.size(), max<size_t>(rank, 1)) - 1] / 1000.0;
+}
+
+Result run(const Config &config, const Settings &settings) {
+    Result result;
+    RAID6::RAID6 raid6;
+    size_t row_bytes = (size_t)(config.disks - 2) * config.block_size;
+    int num_blocks = max<size_t>(1, settings.working_set / row_bytes);
+    if (raid6.init(settings.dir, config.disks, num_blocks, config.block_size))
+        return result;
+    size_t volume = raid6.get_volume_size();
+    size_t slots = volume / config.io_size;
+    if (slots == 0)
+        return result;
+
+    // reads see written data, not holes
+    {
+        vector<char> fill(config.io_size);
+        mt19937_64 rng(1);
+        for (auto &c : fill) c = rng();
+        for (size_t slot = 0; slot < slots; ++slot)
+            raid6.put_logical(slot * config.io_size, config.io_size, fill.data());
+        raid6.flush();
+    }
+    for (int i = 0; i < config.degraded; ++i)
+        raid6.fail_disk(i);
+
+    using clock = chrono::steady_clock;
+    auto start = clock::now();
+    auto measure_start = start + chrono::duration_cast<clock::duration>(chrono::duration<double>(settings.warmup));
+    auto end = measure_start + chrono::duration_cast<clock::duration>(chrono::duration<double>(settings.seconds));
+    vector<vector<int64_t>> latencies(config.threads);
+    vector<size_t> errors(config.threads, 0);
+    vector<thread> workers;
+    for (int t = 0; t < config.threads; ++t) {
+        workers.emplace_back([&, t]() {
+            vector<char> buf(config.io_size, (char)t);
+            mt19937_64 rng(7490 + t);
+            // sequential threads each walk their own share of the volume
+            size_t cursor = slots * t / config.threads;
+            auto &samples = latencies[t];
+            samples.reserve(1 << 16);
+            while (true) {
+                size_t slot = config.random ? rng() % slots : cursor++ % slots;
+                bool read = (int)(rng() % 100) < config.read_pct;
+                auto before = clock::now();
+                if (before >= end)
+                    break;
+                int status = read ? raid6.get_logical(slot * config.io_size, config.io_size, buf.data())
+                                  : raid6.put_logical(slot * config.io_size, config.io_size, buf.data());
+                auto after = clock::now();
+                if (status)
+                    errors[t]++;
+                if (before >= measure_start && after <= end)
+                    samples.push_back(chrono::duration_cast<chrono::nanoseconds>(after - before).count());
+            }
+        });
+    }
+    for (auto &w : workers) w.join();
+
+    vector<int64_t> all;
+    for (int t = 0; t < config.threads; ++t) {
+        all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+        result.errors += errors[t];
+    }
+    sort(all.begin(), all.end());
+    result.ops = all.size();
+    result.seconds = settings.seconds;
+    result.iops = result.ops / result.seconds;
+    result.mb_per_sec = result.ops * config.io_size / result.seconds / 1e6;
+    double total = 0;
+    for (int64_t ns : all) total += ns;
+    result.mean_us = all.empty() ? 0 : total / all.size() / 1000.0;
+    result.p50_us = percentile(all, 0.50);
+    result.p99_us = percentile(all, 0.99);
+    result.p999_us = percentile(all, 0.999);
+    return result;
+}
+
+const char *CSV_HEADER = "disks,block_size,io_size,read_pct,pattern,threads,degraded,"
+                         "ops,errors,mb_per_sec,iops,mean_us,p50_us,p99_us,p999_us";
+
+// the configuration columns, what a baseline line is matched on
+string key(const Config &c) {
+    ostringstream out;
+    out << c.disks << "," << c.block_size << "," << c.io_size << "," << c.read_pct << ","
+        << (c.random ? "random" : "sequential") << "," << c.threads << "," << c.degraded;
+    return out.str();
+}
+
+string format(const Config &c, const Result &r, bool json) {
+    ostringstream out;
+    if (json) {
+        out << "{\"disks\":" << c.disks << ",\"block_size\":" << c.block_size << ",\"io_size\":" << c.io_size
+            << ",\"read_pct\":" << c.read_pct << ",\"pattern\":\"" << (c.random ? "random" : "sequential")
+            << "\",\"threads\":" << c.threads << ",\"degraded\":" << c.degraded << ",\"ops\":" << r.ops
+            << ",\"errors\":" << r.errors << ",\"mb_per_sec\":" << r.mb_per_sec << ",\"iops\":" << r.iops
+            << ",\"mean_us\":" << r.mean_us << ",\"p50_us\":" << r.p50_us << ",\"p99_us\":" << r.p99_us
+            << ",\"p999_us\":" << r.p999_us << "}";
+    } else {
+        out << key(c) << "," << r.ops << "," << r.errors << "," << r.mb_per_sec << "," << r.iops << ","
+            << r.mean_us << "," << r.p50_us << "," << r.p99_us << "," << r.p999_us;
+    }
+    return out.str();
+}
+
+// The configurations to run. Each axis alone around the baseline, or with
+// full every combination; the baseline itself is run once.
+vector<Config> sweep(bool quick, bool full) {
+    vector<int> disks = quick ? vector<int>{4, 8} : vector<int>{4, 6, 8, 12};
+    vector<int> block_sizes = quick ? vector<int>{4096} : vector<int>{4096, 16384, 65536};
+    vector<size_t> io_sizes = quick ? vector<size_t>{4096, 64 * 1024} : vector<size_t>{4096, 64 * 1024, 1024 * 1024};
+    vector<int> read_pcts = {0, 50, 100};
+    vector<bool> patterns = {false, true};
+    vector<int> threads = quick ? vector<int>{1, 4} : vector<int>{1, 2, 4, 8};
+    vector<int> degraded = {0, 1, 2};
+
+    vector<Config> configs;
+    if (full) {
+        for (int d : disks)
+        for (int bs : block_sizes)
+        for (size_t io : io_sizes)
+        for (int rp : read_pcts)
+        for (bool random : patterns)
+        for (int t : threads)
+        for (int deg : degraded)
+            configs.push_back({d, bs, io, rp, random, t, deg});
+        return configs;
+    }
+    Config base;
+    configs.push_back(base);
+    auto vary = [&](auto values, auto set) {
+        for (auto value : values) {
+            Config c = base;
+            set(c, value);
+            if (key(c) != key(base))
+                configs.push_back(c);
+        }
+    };
+    vary(disks, [](Config &c, int v) { c.disks = v; });
+    vary(block_sizes, [](Config &c, int v) { c.block_size = v; });
+    vary(io_sizes, [](Config &c, size_t v) { c.io_size = v; });
+    vary(read_pcts, [](Config &c, int v) { c.read_pct = v; });
+    vary(patterns, [](Config &c, bool v) { c.random = v; });
+    vary(threads, [](Config &c, int v) { c.threads = v; });
+    vary(degraded, [](Config &c, int v) { c.degraded = v; });
+    return configs;
+}
+
+// configuration columns -> mb_per_sec and p99_us of an earlier CSV run
+map<string, pair<double, double>> read_baseline(const string &path) {
+    map<string, pair<double, double>> baseline;
+    ifstream file(path);
+    string line;
+    getline(file, line);
+    while (getline(file, line)) {
+        vector<string> fields;
+        stringstream in(line);
+        string field;
+        while (getline(in, field, ',')) fields.push_back(field);
+        if (fields.size() != 15)
+            continue;
+        string k = fields[0];
+        for (int i = 1; i < 7; ++i) k += "," + fields[i];
+        baseline[k] = {stod(fields[9]), stod(fields[13])};
+    }
+    return baseline;
+}
+
+int main(int argc, char **argv) {
+    Settings settings;
+    bool quick = false;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--quick") {
+            quick = true;
+            settings.seconds = 0.25;
+            settings.warmup = 0.05;
+            settings.working_set = 16 << 20;
+        } else if (arg == "--full") {
+            settings.full = true;
+        } else if (arg == "--json") {
+            settings.json = true;
+        } else if (arg == "--seconds" && has_value) {
+            settings.seconds = stod(argv[++i]);
+        } else if (arg == "--warmup" && has_value) {
+            settings.warmup = stod(argv[++i]);
+        } else if (arg == "--dir" && has_value) {
+            settings.dir = argv[++i];
+        } else if (arg == "--baseline" && has_value) {
+            settings.baseline = argv[++i];
+        } else if (arg == "--tolerance" && has_value) {
+            settings.tolerance = stod(argv[++i]);
+        } else {
+            cerr << "Error: unknown argument " << arg << endl;
+            return 2;
+        }
+    }
+    if (!settings.baseline.empty() && settings.json) {
+        cerr << "Error: --baseline compares CSV output" << endl;
+        return 2;
+    }
+    auto baseline = settings.baseline.empty() ? map<string, pair<double, double>>() : read_baseline(settings.baseline);
+
+    vector<Config> configs = sweep(quick, settings.full);
+    if (!settings.json)
+        cout << CSV_HEADER << endl;
+    int regressions = 0;
+    for (size_t i = 0; i < configs.size(); ++i) {
+        const Config &c = configs[i];
+        cerr << "[" << i + 1 << "/" << configs.size() << "] " << key(c) << endl;
+        Result r = run(c, settings);
+        cout << format(c, r, settings.json) << endl;
+        auto it = baseline.find(key(c));
+        if (it == baseline.end())
+            continue;
+        double old_mb = it->second.first, old_p99 = it->second.second;
+        if (r.mb_per_sec < old_mb * (1 - settings.tolerance) || r.p99_us > old_p99 * (1 + settings.tolerance)) {
+            cerr << "regression: " << key(c) << " mb_per_sec " << old_mb << " -> " << r.mb_per_sec
+                 << " p99_us " << old_p99 << " -> " << r.p99_us << endl;
+            regressions++;
+        }
+    }
+    std::error_code error;
+    std::filesystem::remove_all(settings.dir, error);
+    if (regressions)
+        cerr << regressions << " of " << configs.size() << " configurations regressed" << endl;
+    return regressions ? 1 : 0;
+}
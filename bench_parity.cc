@@ -0,0 +1,138 @@
+// Parity math alone, without any file I/O: GB/s of every kernel for
+//
+//   encode        P and Q of a row (gen_syndrome)
+//   encode_q      Q of a row on its own (cal_RS_parity)
+//   update        P and Q after one data block changed, as a small put does
+//   decode_p      a data block from P and the rest of the row
+//   decode_q      a data block from Q and the rest of the row
+//   decode_pair   two data blocks from P and Q, as a double rebuild does
+//
+// GB/s counts the data blocks of the row, or the changed block for update.
+//
+//   g++ -O2 -o bench_parity bench_parity.cc
+//   ./bench_parity [--quick] [--json]
+//
+// Each case runs for a fixed time after one untimed pass and reports the
+// best of its repetitions. The kernel and syndrome block the auto-tuner
+// picked on this CPU are printed to stderr first.
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "include/parity.hpp"
+
+using namespace std;
+
+// buffers of a row, aligned like the arena's
+struct Row {
+    vector<char *> data;
+    char *p, *q, *out_x, *out_y, *zeros;
+    vector<void *> allocations;
+
+    Row(int ndata, size_t len) {
+        for (int i = 0; i < ndata + 5; ++i) {
+            void *mem = nullptr;
+            if (posix_memalign(&mem, 64, len))
+                abort();
+            char *c = (char *)mem;
+            for (size_t j = 0; j < len; ++j) c[j] = (char)(j * 131 + i * 17 + (j >> 7));
+            allocations.push_back(mem);
+            if (i < ndata)
+                data.push_back(c);
+        }
+        p = (char *)allocations[ndata];
+        q = (char *)allocations[ndata + 1];
+        out_x = (char *)allocations[ndata + 2];
+        out_y = (char *)allocations[ndata + 3];
+        zeros = (char *)allocations[ndata + 4];
+        fill(zeros, zeros + len, 0);
+    }
+    ~Row() {
+        for (void *mem : allocations) free(mem);
+    }
+};
+
+// best GB/s of a few timed batches, bytes per call
+double measure(const function<void()> &call, double bytes, double seconds) {
+    call();
+    double best = 0;
+    auto deadline = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+    int calls = 1;
+    while (chrono::steady_clock::now() < deadline) {
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < calls; ++i) call();
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        best = max(best, bytes * calls / elapsed / 1e9);
+        // batches of at least 1 ms keep the clock out of the result
+        if (elapsed < 1e-3)
+            calls *= 2;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    bool quick = false, json = false;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--quick") {
+            quick = true;
+        } else if (arg == "--json") {
+            json = true;
+        } else {
+            cerr << "Error: unknown argument " << arg << endl;
+            return 2;
+        }
+    }
+    double seconds = quick ? 0.02 : 0.2;
+    vector<int> data_disks = quick ? vector<int>{4, 16} : vector<int>{2, 4, 8, 16, 32};
+    vector<size_t> block_sizes = quick ? vector<size_t>{4096, 65536} : vector<size_t>{4096, 16384, 65536, 262144, 1048576};
+
+    const RAID6::ParityTuning &tuning = RAID6::tuned_parity();
+    cerr << "tuned kernel: " << tuning.kernel->name << " syndrome block: " << tuning.syndrome_block << endl;
+
+    if (!json)
+        cout << "op,kernel,data_disks,block_size,gb_per_sec" << endl;
+    RAID6::Parity parity(0);
+    for (const RAID6::GFKernel *kernel : RAID6::kernels::available())
+    for (int ndata : data_disks)
+    for (size_t len : block_sizes) {
+        parity.set_kernel(*kernel);
+        parity.set_syndrome_block(tuning.syndrome_block);
+        Row row(ndata, len);
+        // the row as a decode sees it, blocks x and y lost
+        int x = 0, y = ndata - 1;
+        vector<char *> without_x = row.data, without_xy = row.data, survivors_p;
+        without_x[x] = row.zeros;
+        without_xy[x] = without_xy[y] = row.zeros;
+        survivors_p.assign(row.data.begin() + 1, row.data.end());
+        survivors_p.push_back(row.p);
+        double row_bytes = (double)ndata * len;
+
+        vector<pair<string, double>> results;
+        results.push_back({"encode", measure([&]() { parity.gen_syndrome(len, row.data, row.p, row.q); }, row_bytes, seconds)});
+        results.push_back({"encode_q", measure([&]() { parity.cal_RS_parity(len, row.data, row.q); }, row_bytes, seconds)});
+        results.push_back({"update", measure([&]() {
+            parity.update<RAID6::PolicyXOR>(len, row.data[x], row.out_x, row.p, x);
+            parity.update<RAID6::PolicyRS>(len, row.data[x], row.out_x, row.q, x);
+        }, len, seconds)});
+        results.push_back({"decode_p", measure([&]() { parity.calculate<RAID6::PolicyXOR>(len, survivors_p, row.out_x); }, row_bytes, seconds)});
+        results.push_back({"decode_q", measure([&]() { parity.decode_data_q(len, without_x, x, row.q, row.out_x); }, row_bytes, seconds)});
+        results.push_back({"decode_pair", measure([&]() {
+            parity.decode_data_pair(len, without_xy, x, y, row.p, row.q, row.out_x, row.out_y);
+        }, row_bytes, seconds)});
+
+        for (auto &result : results) {
+            if (json) {
+                cout << "{\"op\":\"" << result.first << "\",\"kernel\":\"" << kernel->name << "\",\"data_disks\":" << ndata
+                     << ",\"block_size\":" << len << ",\"gb_per_sec\":" << result.second << "}" << endl;
+            } else {
+                cout << result.first << "," << kernel->name << "," << ndata << "," << len << "," << result.second << endl;
+            }
+        }
+    }
+    return 0;
+}
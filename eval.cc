@@ -1,7 +1,11 @@
+#include <algorithm>
 #include <fstream>
 #include <chrono>
+#include <cstdio>
 #include <cstring>
+#include <future>
 #include <iostream>
+#include <thread>
 #include <vector>
 #include "include/RAID6.hpp"
 
@@ -13,7 +17,44 @@ int main() {
     char data[8192];
     memset(data, 0, 8192);
 
-    // Test 1: num_disk & put/get time per block
+    // Test 0: every GF kernel matches the byte-by-byte table lookup
+    {
+        RAID6::Parity parity(6);
+        const size_t len = 4096 + 37; // odd length to cover the scalar tails
+        vector<vector<char>> blocks(6, vector<char>(len));
+        vector<char *> ptrs;
+        srand(7490);
+        for (auto &b : blocks) {
+            for (auto &c : b) c = rand();
+            ptrs.push_back(b.data());
+        }
+        vector<char> ref_p(len, 0), ref_q(len, 0), ref_mul(len), ref_xor(len);
+        for (size_t byte = 0; byte < len; ++byte) {
+            for (int i = 0; i < (int)ptrs.size(); ++i) {
+                ref_p[byte] ^= ptrs[i][byte];
+                ref_q[byte] ^= parity.gf_multiply(parity.gf_pow_02(i), ptrs[i][byte]);
+            }
+            ref_mul[byte] = parity.gf_multiply(ptrs[0][byte], 0x8e);
+            ref_xor[byte] = ptrs[0][byte] ^ ptrs[1][byte];
+        }
+        for (auto kernel : RAID6::kernels::available()) {
+            parity.set_kernel(*kernel);
+            vector<char> p(len), q(len), mul(len), x(len);
+            parity.cal_XOR_parity(len, ptrs, p.data());
+            parity.cal_RS_parity(len, ptrs, q.data());
+            parity.gf_multiply_byte_block(ptrs[0], (char)0x8e, len, mul.data());
+            parity.XOR_block(ptrs[0], ptrs[1], len, x.data());
+            vector<char> sp(len), sq(len);
+            parity.gen_syndrome(len, ptrs, sp.data(), sq.data());
+            bool ok = p == ref_p && q == ref_q && mul == ref_mul && x == ref_xor && sp == ref_p && sq == ref_q;
+            cout << "kernel " << kernel->name << ": " << (ok ? "ok" : "MISMATCH") << endl;
+            if (!ok) {
+                return 1;
+            }
+        }
+    }
+
+    // Test 1: num_disk & put/get time per block, in us
     ofstream test1_file("output_num_disks.csv");
     if (!test1_file.is_open()) {
         cerr << "Error opening file!" << endl;
@@ -21,28 +62,33 @@ int main() {
     }
     test1_file << "num_disks,put_time_per_block,get_time_per_block\n";
 
-    for (int num_disk = 3; num_disk <= 10; num_disk++) {
+    for (int num_disk = 4; num_disk <= 10; num_disk++) {
         RAID6::RAID6 *raid6 = new RAID6::RAID6();
         raid6->init("data_" + to_string(num_disk) + "/", num_disk, 10, 4096);
         raid6_list.push_back(raid6);
     }
 
     for (auto &raid6 : raid6_list) {
-        // Measure put time
+        // Measure put time, a block of each data disk
+        int num_data = raid6->num_disks - 2;
         auto start = chrono::steady_clock::now();
-        for (int disk = 0; disk < raid6->num_disks; disk++) {
-            raid6->put(0, disk, 4096, data);
+        for (int i = 0; i < 1000; ++i) {
+            for (int disk = 0; disk < num_data; disk++) {
+                raid6->put(disk, 0, 4096, data);
+            }
         }
         auto end = chrono::steady_clock::now();
-        auto put_time_per_block = chrono::duration_cast<chrono::microseconds>(end - start).count() / raid6->num_disks;
+        double put_time_per_block = chrono::duration<double, micro>(end - start).count() / (1000 * num_data);
 
         // Measure get time
         start = chrono::steady_clock::now();
-        for (int disk = 0; disk < raid6->num_disks; disk++) {
-            raid6->get(disk, 0, 4096, data);
+        for (int i = 0; i < 1000; ++i) {
+            for (int disk = 0; disk < num_data; disk++) {
+                raid6->get(disk, 0, 4096, data);
+            }
         }
         end = chrono::steady_clock::now();
-        auto get_time_per_block = chrono::duration_cast<chrono::microseconds>(end - start).count() / raid6->num_disks;
+        double get_time_per_block = chrono::duration<double, micro>(end - start).count() / (1000 * num_data);
 
         // Write num_disks, put_time_per_block, get_time_per_block to CSV
         test1_file << raid6->num_disks << "," << put_time_per_block << "," << get_time_per_block << "\n";
@@ -56,7 +102,7 @@ int main() {
     }
     raid6_list.clear();  // Clear the vector to reuse it in other tests
 
-    // Test 2: block_size & put/get time per byte
+    // Test 2: block_size & put/get time per byte, in ns
     ofstream test2_file("output_block_size.csv");
     if (!test2_file.is_open()) {
         cerr << "Error opening file!" << endl;
@@ -79,7 +125,7 @@ int main() {
             }
         }
         auto end = chrono::steady_clock::now();
-        auto put_time_per_byte = chrono::duration_cast<chrono::microseconds>(end - start).count() / raid6->block_size;
+        double put_time_per_byte = chrono::duration<double, nano>(end - start).count() / (1000.0 * raid6->num_disks * raid6->block_size);
 
         // Measure get time
         start = chrono::steady_clock::now();
@@ -89,7 +135,7 @@ int main() {
             }
         }
         end = chrono::steady_clock::now();
-        auto get_time_per_byte = chrono::duration_cast<chrono::microseconds>(end - start).count() / raid6->block_size;
+        double get_time_per_byte = chrono::duration<double, nano>(end - start).count() / (1000.0 * raid6->num_disks * raid6->block_size);
 
         // Write block_size, put_time_per_byte, get_time_per_byte to CSV
         test2_file << raid6->block_size << "," << put_time_per_byte << "," << get_time_per_byte << "\n";
@@ -103,7 +149,7 @@ int main() {
     }
     raid6_list.clear();  // Clear the vector to reuse it in the next test*/
 
-    // Test 3: reconstruct time per byte vs block size
+    // Test 3: reconstruct time per byte vs block size, in ns
     ofstream test3_file("output_recovery_time.csv");
     if (!test3_file.is_open()) {
         cerr << "Error opening file!" << endl;
@@ -128,8 +174,8 @@ int main() {
               for (int i=0;i<1000;++i)
                 raid6->recover(recover_blocks[test_case]);
               auto end = chrono::steady_clock::now();
-              auto recover_time_per_byte = chrono::duration_cast<chrono::microseconds>(end - start).count() / raid6->block_size;
-              cout << "block_size: " << raid6->block_size << " case: " << test_case << " recover time per KB: " << recover_time_per_byte << "us" << endl;
+              double recover_time_per_byte = chrono::duration<double, nano>(end - start).count() / (1000.0 * raid6->block_size);
+              cout << "block_size: " << raid6->block_size << " case: " << test_case << " recover time per byte: " << recover_time_per_byte << "ns" << endl;
               // Write block_size, test_case, recover_time_per_byte to CSV
               test3_file << raid6->block_size << "," << test_case << "," << recover_time_per_byte << "\n";
         
@@ -142,6 +188,779 @@ int main() {
     for (auto &raid6 : raid6_list) {
         delete raid6;
     }
+    raid6_list.clear();
+
+    // Test 4: storage backend & put/get time per block
+    ofstream test4_file("output_backend.csv");
+    if (!test4_file.is_open()) {
+        cerr << "Error opening file!" << endl;
+        return 1;
+    }
+    test4_file << "backend,put_time_per_block,get_time_per_block\n";
+
+    vector<pair<string, RAID6::Options>> backends(6);
+    backends[0].first = "file";
+    backends[1].first = "file_io_uring";
+    backends[1].second.io_mode = RAID6::IO_URING;
+    backends[2].first = "file_threads";
+    backends[2].second.io_mode = RAID6::IO_THREADS;
+    backends[2].second.queue_depth = 4;
+    backends[3].first = "mmap";
+    backends[3].second.backend = RAID6::BACKEND_MMAP;
+    backends[4].first = "stream";
+    backends[4].second.backend = RAID6::BACKEND_STREAM;
+    backends[5].first = "file_direct";
+    backends[5].second.direct_io = true;
+    for (auto &backend : backends) {
+        RAID6::RAID6 raid6;
+        RAID6::Options options = backend.second;
+        raid6.init("data_backend_" + backend.first + "/", 6, 10, 4096, options);
+
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < 1000; ++i) {
+            for (int disk = 0; disk < raid6.num_disks - 2; disk++) {
+                raid6.put(disk, 0, raid6.block_size, data);
+            }
+        }
+        auto end = chrono::steady_clock::now();
+        auto put_time_per_block = chrono::duration_cast<chrono::nanoseconds>(end - start).count() / 1000.0 / (1000 * (raid6.num_disks - 2));
+
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < 1000; ++i) {
+            for (int disk = 0; disk < raid6.num_disks - 2; disk++) {
+                raid6.get(disk, 0, raid6.block_size, data);
+            }
+        }
+        end = chrono::steady_clock::now();
+        auto get_time_per_block = chrono::duration_cast<chrono::nanoseconds>(end - start).count() / 1000.0 / (1000 * (raid6.num_disks - 2));
+
+        cout << "backend: " << backend.first << " put: " << put_time_per_block << "us get: " << get_time_per_block << "us" << endl;
+        test4_file << backend.first << "," << put_time_per_block << "," << get_time_per_block << "\n";
+    }
+
+    test4_file.close();
+
+    // Test 5: sequential ingest, block by block vs whole stripes
+    ofstream test5_file("output_stripe.csv");
+    if (!test5_file.is_open()) {
+        cerr << "Error opening file!" << endl;
+        return 1;
+    }
+    test5_file << "num_disks,per_block_time_per_block,full_stripe_time_per_block\n";
+
+    for (int num_disks = 4; num_disks <= 10; num_disks += 2) {
+        RAID6::RAID6 raid6;
+        raid6.init("data_stripe_" + to_string(num_disks) + "/", num_disks, 100, 4096);
+        int num_data = num_disks - 2;
+        vector<vector<char>> row_data(num_data, vector<char>(4096, 1));
+        vector<char *> row;
+        for (auto &d : row_data) row.push_back(d.data());
+
+        // every block on its own, the way put() sees a stream of single block writes
+        auto start = chrono::steady_clock::now();
+        for (int block = 0; block < raid6.num_blocks; ++block) {
+            for (int i = 0; i < num_data; ++i) {
+                vector<char *> one(num_data, nullptr);
+                one[i] = row[i];
+                raid6.put_stripe(block, one);
+            }
+        }
+        auto end = chrono::steady_clock::now();
+        auto per_block_time = chrono::duration_cast<chrono::nanoseconds>(end - start).count() / 1000.0 / (raid6.num_blocks * num_data);
+
+        start = chrono::steady_clock::now();
+        for (int block = 0; block < raid6.num_blocks; ++block) {
+            raid6.put_stripe(block, row);
+        }
+        end = chrono::steady_clock::now();
+        auto full_stripe_time = chrono::duration_cast<chrono::nanoseconds>(end - start).count() / 1000.0 / (raid6.num_blocks * num_data);
+
+        cout << "num_disks: " << num_disks << " per block: " << per_block_time << "us full stripe: " << full_stripe_time << "us" << endl;
+        test5_file << num_disks << "," << per_block_time << "," << full_stripe_time << "\n";
+    }
+
+    test5_file.close();
+
+    // Test 6: small writes to the same rows, write through vs the stripe cache
+    ofstream test6_file("output_cache.csv");
+    if (!test6_file.is_open()) {
+        cerr << "Error opening file!" << endl;
+        return 1;
+    }
+    test6_file << "cache_stripes,put_time_per_write,get_time_per_read\n";
+
+    for (int cache_stripes : {0, 1, 16}) {
+        RAID6::RAID6 raid6;
+        RAID6::Options options;
+        options.cache_stripes = cache_stripes;
+        raid6.init("data_cache_" + to_string(cache_stripes) + "/", 6, 10, 4096, options);
+
+        // every write different, the first block of each data disk as the disks should hold it
+        vector<char> writes(10000 * 512);
+        vector<vector<char>> model(raid6.num_disks - 2, vector<char>(raid6.block_size, 0));
+        srand(10);
+        for (auto &c : writes) c = rand();
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < 10000; ++i) {
+            int disk = rand() % (raid6.num_disks - 2), position = rand() % 3584;
+            raid6.put(disk, position, 512, writes.data() + i * 512);
+            memcpy(model[disk].data() + position, writes.data() + i * 512, 512);
+        }
+        raid6.flush();
+        auto end = chrono::steady_clock::now();
+        auto put_time = chrono::duration_cast<chrono::nanoseconds>(end - start).count() / 1000.0 / 10000;
+
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < 10000; ++i) {
+            raid6.get(rand() % (raid6.num_disks - 2), rand() % 3584, 512, data);
+        }
+        end = chrono::steady_clock::now();
+        auto get_time = chrono::duration_cast<chrono::nanoseconds>(end - start).count() / 1000.0 / 10000;
+
+        bool ok = raid6.check() == 0;
+        for (int disk = 0; disk < raid6.num_disks - 2; ++disk) {
+            ok = ok && raid6.get(disk, 0, raid6.block_size, data) == 0 && memcmp(data, model[disk].data(), raid6.block_size) == 0;
+        }
+        cout << "cache_stripes: " << cache_stripes << " put: " << put_time << "us get: " << get_time << "us " << (ok ? "ok" : "MISMATCH") << endl;
+        if (!ok) {
+            return 1;
+        }
+        test6_file << cache_stripes << "," << put_time << "," << get_time << "\n";
+    }
+
+    test6_file.close();
+
+    // Test 7: reads with failed disks, rebuilt in memory
+    ofstream test7_file("output_degraded.csv");
+    if (!test7_file.is_open()) {
+        cerr << "Error opening file!" << endl;
+        return 1;
+    }
+    test7_file << "failed_disks,get_time_per_block\n";
+
+    {
+        RAID6::RAID6 raid6;
+        raid6.init("data_degraded/", 6, 10, 4096);
+        // what the reads must return, rebuilt or not
+        vector<char> written((raid6.num_disks - 2) * raid6.block_size);
+        srand(11);
+        for (auto &c : written) c = rand();
+        for (int disk = 0; disk < raid6.num_disks - 2; disk++) {
+            raid6.put(disk, 0, raid6.block_size, written.data() + disk * raid6.block_size);
+        }
+        for (int num_failed = 0; num_failed <= 2; ++num_failed) {
+            if (num_failed > 0)
+                raid6.fail_disk(num_failed - 1);
+            auto start = chrono::steady_clock::now();
+            for (int i = 0; i < 1000; ++i) {
+                for (int disk = 0; disk < raid6.num_disks - 2; disk++) {
+                    raid6.get(disk, 0, raid6.block_size, data);
+                }
+            }
+            auto end = chrono::steady_clock::now();
+            auto get_time_per_block = chrono::duration_cast<chrono::nanoseconds>(end - start).count() / 1000.0 / (1000 * (raid6.num_disks - 2));
+
+            bool ok = true;
+            for (int disk = 0; disk < raid6.num_disks - 2; disk++) {
+                ok = ok && raid6.get(disk, 0, raid6.block_size, data) == 0 &&
+                     memcmp(data, written.data() + disk * raid6.block_size, raid6.block_size) == 0;
+            }
+            cout << "failed disks: " << num_failed << " get: " << get_time_per_block << "us " << (ok ? "ok" : "MISMATCH") << endl;
+            if (!ok) {
+                return 1;
+            }
+            test7_file << num_failed << "," << get_time_per_block << "\n";
+        }
+    }
+
+    test7_file.close();
+
+    // Test 8: whole disk rebuild throughput by worker count
+    ofstream test8_file("output_rebuild.csv");
+    if (!test8_file.is_open()) {
+        cerr << "Error opening file!" << endl;
+        return 1;
+    }
+    test8_file << "threads,rebuild_time,mb_per_sec\n";
+
+    {
+        RAID6::RAID6 raid6;
+        raid6.init("data_rebuild/", 6, 2000, 4096);
+        vector<char> volume(raid6.get_volume_size()), back(volume.size());
+        srand(12);
+        for (auto &c : volume) c = rand();
+        raid6.put_logical(0, volume.size(), volume.data());
+        for (int threads : {1, 2, 4}) {
+            // both disks replaced by empty ones
+            for (int disk : {0, 3}) {
+                raid6.fail_disk(disk);
+                std::remove(("data_rebuild/disk" + to_string(disk)).c_str());
+            }
+            RAID6::RebuildOptions rebuild_options;
+            rebuild_options.threads = threads;
+            auto start = chrono::steady_clock::now();
+            raid6.rebuild_disk(0, 3, rebuild_options);
+            auto end = chrono::steady_clock::now();
+            auto rebuild_time = chrono::duration_cast<chrono::microseconds>(end - start).count() / 1000000.0;
+            double mb_per_sec = 2.0 * raid6.num_blocks * raid6.block_size / rebuild_time / 1000000;
+
+            bool ok = raid6.check() == 0 && raid6.get_logical(0, back.size(), back.data()) == 0 && back == volume;
+            cout << "rebuild threads: " << threads << " time: " << rebuild_time << "s " << mb_per_sec << "MB/s " << (ok ? "ok" : "MISMATCH") << endl;
+            if (!ok) {
+                return 1;
+            }
+            test8_file << threads << "," << rebuild_time << "," << mb_per_sec << "\n";
+        }
+    }
+
+    test8_file.close();
+
+    // Test 9: scrub throughput by worker count
+    ofstream test9_file("output_scrub.csv");
+    if (!test9_file.is_open()) {
+        cerr << "Error opening file!" << endl;
+        return 1;
+    }
+    test9_file << "threads,scrub_time,mb_per_sec\n";
+
+    {
+        RAID6::RAID6 raid6;
+        raid6.init("data_scrub/", 6, 2000, 4096);
+        vector<char> volume(raid6.get_volume_size()), back(volume.size());
+        srand(13);
+        for (auto &c : volume) c = rand();
+        raid6.put_logical(0, volume.size(), volume.data());
+        for (int threads : {1, 2, 4}) {
+            // one bad block in each of 8 rows, on every disk in turn
+            const int bad_rows = 8;
+            vector<char> junk(100, 0x5a);
+            for (int k = 0; k < bad_rows; ++k) {
+                int block = k * 250 + threads;
+                raid6.put_no_parity(k % raid6.num_disks, (size_t)block * raid6.block_size + 1000, junk.size(), junk.data());
+            }
+            RAID6::ScrubOptions scrub_options;
+            scrub_options.threads = threads;
+            RAID6::ScrubReport report;
+            raid6.scrub(report, scrub_options);
+
+            bool ok = report.errors.size() == bad_rows && report.repaired == bad_rows && raid6.check() == 0 &&
+                      raid6.get_logical(0, back.size(), back.data()) == 0 && back == volume;
+            cout << "scrub threads: " << threads << " time: " << report.elapsed << "s " << report.bytes_per_sec / 1000000 << "MB/s " << (ok ? "ok" : "MISMATCH") << endl;
+            if (!ok) {
+                return 1;
+            }
+            test9_file << threads << "," << report.elapsed << "," << report.bytes_per_sec / 1000000 << "\n";
+        }
+    }
+
+    test9_file.close();
+
+    // Test 10: cost of block checksums on put and get
+    ofstream test10_file("output_checksum.csv");
+    if (!test10_file.is_open()) {
+        cerr << "Error opening file!" << endl;
+        return 1;
+    }
+    test10_file << "checksums,put_time_per_block,get_time_per_block\n";
+
+    for (bool checksums : {false, true}) {
+        RAID6::RAID6 raid6;
+        RAID6::Options options;
+        options.checksums = checksums;
+        raid6.init("data_checksum_" + to_string(checksums) + "/", 6, 10, 4096, options);
+
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < 1000; ++i) {
+            for (int disk = 0; disk < raid6.num_disks - 2; disk++) {
+                raid6.put(disk, 0, raid6.block_size, data);
+            }
+        }
+        auto end = chrono::steady_clock::now();
+        auto put_time_per_block = chrono::duration_cast<chrono::nanoseconds>(end - start).count() / 1000.0 / (1000 * (raid6.num_disks - 2));
+
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < 1000; ++i) {
+            for (int disk = 0; disk < raid6.num_disks - 2; disk++) {
+                raid6.get(disk, 0, raid6.block_size, data);
+            }
+        }
+        end = chrono::steady_clock::now();
+        auto get_time_per_block = chrono::duration_cast<chrono::nanoseconds>(end - start).count() / 1000.0 / (1000 * (raid6.num_disks - 2));
+
+        // a block gone bad on disk 0; only a checksum tells the reads it is not the data
+        vector<char> volume(raid6.get_volume_size()), back(volume.size()), junk(raid6.block_size, 0x5a);
+        raid6.get_logical(0, volume.size(), volume.data());
+        raid6.put_no_parity(0, 0, junk.size(), junk.data());
+        bool caught = raid6.get_logical(0, back.size(), back.data()) == 0 && back == volume;
+        // and the reads wrote the rebuilt block back
+        bool repaired = caught && raid6.check() == 0;
+
+        cout << "checksums: " << checksums << " put: " << put_time_per_block << "us get: " << get_time_per_block << "us bad block: " << (repaired ? "repaired" : "missed") << endl;
+        if (checksums && !repaired) {
+            return 1;
+        }
+        test10_file << checksums << "," << put_time_per_block << "," << get_time_per_block << "\n";
+    }
+
+    test10_file.close();
+
+    // Test 11: cost of the write-intent bitmap on put
+    ofstream test11_file("output_write_intent.csv");
+    if (!test11_file.is_open()) {
+        cerr << "Error opening file!" << endl;
+        return 1;
+    }
+    test11_file << "write_intent,put_time_per_block\n";
+
+    for (bool write_intent : {false, true}) {
+        RAID6::RAID6 raid6;
+        RAID6::Options options;
+        options.write_intent = write_intent;
+        raid6.init("data_write_intent_" + to_string(write_intent) + "/", 6, 10, 4096, options);
+
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < 1000; ++i) {
+            for (int disk = 0; disk < raid6.num_disks - 2; disk++) {
+                raid6.put(disk, 0, raid6.block_size, data);
+            }
+        }
+        auto end = chrono::steady_clock::now();
+        auto put_time_per_block = chrono::duration_cast<chrono::nanoseconds>(end - start).count() / 1000.0 / (1000 * (raid6.num_disks - 2));
+
+        // a crash between a data write and its parity: the data of row 0 lands
+        // alone and the array is loaded again while this handle, its region of the
+        // bitmap still set, is open
+        vector<char> parity_written(512, 0x5a), data_landed(512, 0x3c);
+        raid6.put(0, 0, parity_written.size(), parity_written.data());
+        raid6.put_no_parity(0, 0, data_landed.size(), data_landed.data());
+        RAID6::RAID6 reopened;
+        bool resynced = reopened.load("data_write_intent_" + to_string(write_intent) + "/", options) == 0 && reopened.check() == 0;
+
+        cout << "write intent: " << write_intent << " put: " << put_time_per_block << "us after a crash: " << (resynced ? "resynced" : "stale parity") << endl;
+        if (write_intent && !resynced) {
+            return 1;
+        }
+        test11_file << write_intent << "," << put_time_per_block << "\n";
+    }
+
+    test11_file.close();
+
+    // Test 12: put/get throughput from many threads, each on its own rows
+    ofstream test12_file("output_threads.csv");
+    if (!test12_file.is_open()) {
+        cerr << "Error opening file!" << endl;
+        return 1;
+    }
+    test12_file << "threads,put_mb_per_sec,get_mb_per_sec,put_speedup,get_speedup\n";
+
+    // speedups are against one thread, they cannot pass the host's core count
+    cout << "hardware threads: " << thread::hardware_concurrency() << endl;
+    double base_put_mb_per_sec = 0, base_get_mb_per_sec = 0;
+    for (int num_threads : {1, 2, 4, 8}) {
+        RAID6::RAID6 raid6;
+        raid6.init("data_threads/", 6, 64, 4096);
+        const int ops_per_thread = 8000 / num_threads;
+
+        const int num_data = raid6.num_disks - 2;
+        // reads of a thread's rows that did not return its bytes
+        vector<int> misread(num_threads, 0);
+        auto run = [&](bool write) {
+            vector<thread> threads;
+            auto start = chrono::steady_clock::now();
+            for (int t = 0; t < num_threads; ++t) {
+                threads.emplace_back([&, t]() {
+                    // what a thread writes is its own
+                    vector<char> buf(raid6.block_size, (char)(t + 1)), read_buf(raid6.block_size);
+                    vector<char *> row(num_data, nullptr);
+                    row[0] = buf.data();
+                    for (int i = 0; i < ops_per_thread; ++i) {
+                        // rows of different threads never collide
+                        int block = (i * num_threads + t) % raid6.num_blocks;
+                        if (write) {
+                            raid6.put_stripe(block, row);
+                        } else if (raid6.get_logical((size_t)block * num_data * raid6.block_size, raid6.block_size, read_buf.data()) ||
+                                   read_buf != buf) {
+                            misread[t]++;
+                        }
+                    }
+                });
+            }
+            for (auto &th : threads) th.join();
+            auto end = chrono::steady_clock::now();
+            double seconds = chrono::duration<double>(end - start).count();
+            return (double)ops_per_thread * num_threads * raid6.block_size / seconds / 1e6;
+        };
+        double put_mb_per_sec = run(true);
+        double get_mb_per_sec = run(false);
+        if (num_threads == 1) {
+            base_put_mb_per_sec = put_mb_per_sec;
+            base_get_mb_per_sec = get_mb_per_sec;
+        }
+        double put_speedup = put_mb_per_sec / base_put_mb_per_sec, get_speedup = get_mb_per_sec / base_get_mb_per_sec;
+
+        // the first data block of every row as its thread wrote it, the rest untouched
+        bool ok = raid6.check() == 0;
+        vector<char> row(num_data * raid6.block_size), expected(row.size(), 0);
+        for (int block = 0; block < raid6.num_blocks && ok; ++block) {
+            memset(expected.data(), block % num_threads + 1, raid6.block_size);
+            ok = raid6.get_logical((size_t)block * row.size(), row.size(), row.data()) == 0 && row == expected;
+        }
+        for (int t = 0; t < num_threads; ++t) {
+            ok = ok && misread[t] == 0;
+        }
+        cout << "threads: " << num_threads << " put: " << put_mb_per_sec << "MB/s (x" << put_speedup << ") get: " << get_mb_per_sec
+             << "MB/s (x" << get_speedup << ") " << (ok ? "ok" : "MISMATCH") << endl;
+        if (!ok) {
+            return 1;
+        }
+        test12_file << num_threads << "," << put_mb_per_sec << "," << get_mb_per_sec << "," << put_speedup << "," << get_speedup << "\n";
+    }
+
+    test12_file.close();
+
+    // Test 13: small random writes and reads, one call each vs batches of 64
+    ofstream test13_file("output_batch.csv");
+    if (!test13_file.is_open()) {
+        cerr << "Error opening file!" << endl;
+        return 1;
+    }
+    test13_file << "io_mode,mode,put_time_per_extent,get_time_per_extent\n";
+
+    {
+        const int num_disks = 6, num_blocks = 600, block_size = 4096, extent_len = 512, num_extents = 8192, batch_size = 64;
+        const size_t disk_data_size = (size_t)num_blocks / num_disks * (num_disks - 2) * block_size;
+        // each extent written from its own bytes and read into its own buffer
+        vector<char> written((size_t)num_extents * extent_len), read_back(written.size());
+        vector<RAID6::Extent> extents, reads;
+        srand(1713);
+        for (auto &c : written) c = rand();
+        for (int i = 0; i < num_extents; ++i) {
+            int disk = rand() % num_disks;
+            size_t data_block = rand() % (num_blocks / num_disks * (num_disks - 2));
+            size_t offset = rand() % (block_size / extent_len) * extent_len;
+            extents.push_back({disk, data_block * block_size + offset, extent_len, written.data() + (size_t)i * extent_len});
+            reads.push_back({disk, data_block * block_size + offset, extent_len, read_back.data() + (size_t)i * extent_len});
+        }
+        // the data of every disk after all the writes, later extents win
+        vector<vector<char>> model(num_disks, vector<char>(disk_data_size, 0));
+        for (auto &extent : extents) {
+            memcpy(model[extent.disk].data() + extent.position, extent.data, extent.len);
+        }
+        for (auto io_mode : {RAID6::IO_SYNC, RAID6::IO_URING})
+        for (bool batched : {false, true}) {
+            RAID6::RAID6 raid6;
+            RAID6::Options options;
+            options.io_mode = io_mode;
+            raid6.init("data_batch/", num_disks, num_blocks, block_size, options);
+
+            auto start = chrono::steady_clock::now();
+            for (int i = 0; i < num_extents; i += batch_size) {
+                if (batched) {
+                    raid6.put_batch(vector<RAID6::Extent>(extents.begin() + i, extents.begin() + i + batch_size));
+                } else {
+                    for (int j = i; j < i + batch_size; ++j)
+                        raid6.put(extents[j].disk, extents[j].position, extents[j].len, extents[j].data);
+                }
+            }
+            auto end = chrono::steady_clock::now();
+            auto put_time_per_extent = chrono::duration_cast<chrono::nanoseconds>(end - start).count() / 1000.0 / num_extents;
+
+            start = chrono::steady_clock::now();
+            for (int i = 0; i < num_extents; i += batch_size) {
+                if (batched) {
+                    raid6.get_batch(vector<RAID6::Extent>(reads.begin() + i, reads.begin() + i + batch_size));
+                } else {
+                    for (int j = i; j < i + batch_size; ++j)
+                        raid6.get(reads[j].disk, reads[j].position, reads[j].len, reads[j].data);
+                }
+            }
+            end = chrono::steady_clock::now();
+            auto get_time_per_extent = chrono::duration_cast<chrono::nanoseconds>(end - start).count() / 1000.0 / num_extents;
+
+            bool ok = raid6.check() == 0;
+            for (auto &read : reads) {
+                ok = ok && memcmp(read.data, model[read.disk].data() + read.position, read.len) == 0;
+            }
+            const char *mode = batched ? "batch" : "single";
+            cout << "io mode: " << io_mode << " mode: " << mode << " put: " << put_time_per_extent << "us get: " << get_time_per_extent << "us " << (ok ? "ok" : "MISMATCH") << endl;
+            if (!ok) {
+                return 1;
+            }
+            test13_file << io_mode << "," << mode << "," << put_time_per_extent << "," << get_time_per_extent << "\n";
+        }
+    }
+
+    test13_file.close();
+
+    // Test 14: async puts, throughput and latency by executor size
+    ofstream test14_file("output_async.csv");
+    if (!test14_file.is_open()) {
+        cerr << "Error opening file!" << endl;
+        return 1;
+    }
+    test14_file << "async_threads,ops_per_sec,mean_latency,max_latency\n";
+
+    for (int async_threads : {1, 4, 16}) {
+        RAID6::RAID6 raid6;
+        RAID6::Options options;
+        options.async_threads = async_threads;
+        raid6.init("data_async/", 6, 600, 4096, options);
+        const int num_ops = 8000, num_targets = 400;
+        atomic<long> total_ns(0), max_ns(0);
+        // the bytes of a block depend only on where it goes, so any order of
+        // completion leaves the same data
+        vector<char> blocks((size_t)num_targets * raid6.block_size);
+        srand(18);
+        for (auto &c : blocks) c = rand();
+
+        auto start = chrono::steady_clock::now();
+        vector<future<int>> futures;
+        for (int i = 0; i < num_ops; ++i) {
+            // whole data blocks, each disk on its own
+            int target = i % num_targets;
+            size_t position = (size_t)(target / 4) * raid6.block_size;
+            futures.push_back(raid6.async_put(target % 4, position, raid6.block_size, blocks.data() + (size_t)target * raid6.block_size, [&](const RAID6::AsyncResult &result) {
+                long ns = result.latency * 1e9;
+                total_ns += ns;
+                long seen = max_ns;
+                while (ns > seen && !max_ns.compare_exchange_weak(seen, ns)) {
+                }
+            }));
+        }
+        bool ok = true;
+        for (auto &f : futures) ok = f.get() == 0 && ok;
+        auto end = chrono::steady_clock::now();
+        double ops_per_sec = num_ops / chrono::duration<double>(end - start).count();
+        double mean_latency = total_ns / 1000.0 / num_ops;
+        double max_latency = max_ns / 1000.0;
+
+        ok = ok && raid6.check() == 0;
+        for (int target = 0; target < num_targets && ok; ++target) {
+            auto read = raid6.async_get(target % 4, (size_t)(target / 4) * raid6.block_size, raid6.block_size, data);
+            ok = read.get() == 0 && memcmp(data, blocks.data() + (size_t)target * raid6.block_size, raid6.block_size) == 0;
+        }
+        cout << "async threads: " << async_threads << " ops/s: " << ops_per_sec << " mean latency: " << mean_latency << "us max latency: " << max_latency << "us " << (ok ? "ok" : "MISMATCH") << endl;
+        if (!ok) {
+            return 1;
+        }
+        test14_file << async_threads << "," << ops_per_sec << "," << mean_latency << "," << max_latency << "\n";
+    }
+
+    test14_file.close();
+
+    // Test 15: sequential writes and reads, one disk at a time vs the logical volume
+    ofstream test15_file("output_logical.csv");
+    if (!test15_file.is_open()) {
+        cerr << "Error opening file!" << endl;
+        return 1;
+    }
+    test15_file << "mode,put_mb_per_sec,get_mb_per_sec\n";
+
+    for (bool logical : {false, true}) {
+        RAID6::RAID6 raid6;
+        RAID6::Options options;
+        raid6.init("data_logical/", 6, 600, 4096, options);
+        const size_t io_size = 64 * 1024;
+        size_t total = logical ? raid6.get_volume_size() : (size_t)600 / 6 * 4 * 4096;
+        // written from and read into buffers of the whole range
+        vector<char> written(total), read_back(total);
+        srand(19);
+        for (auto &c : written) c = rand();
+
+        auto start = chrono::steady_clock::now();
+        for (size_t pos = 0; pos + io_size <= total; pos += io_size) {
+            if (logical)
+                raid6.put_logical(pos, io_size, written.data() + pos);
+            else
+                raid6.put(0, pos, io_size, written.data() + pos);
+        }
+        raid6.flush();
+        auto end = chrono::steady_clock::now();
+        double put_mb_per_sec = total / 1e6 / chrono::duration<double>(end - start).count();
+
+        start = chrono::steady_clock::now();
+        for (size_t pos = 0; pos + io_size <= total; pos += io_size) {
+            if (logical)
+                raid6.get_logical(pos, io_size, read_back.data() + pos);
+            else
+                raid6.get(0, pos, io_size, read_back.data() + pos);
+        }
+        end = chrono::steady_clock::now();
+        double get_mb_per_sec = total / 1e6 / chrono::duration<double>(end - start).count();
+
+        bool ok = raid6.check() == 0 && read_back == written;
+        const char *mode = logical ? "logical" : "one_disk";
+        cout << "mode: " << mode << " put: " << put_mb_per_sec << "MB/s get: " << get_mb_per_sec << "MB/s " << (ok ? "ok" : "MISMATCH") << endl;
+        if (!ok) {
+            return 1;
+        }
+        test15_file << mode << "," << put_mb_per_sec << "," << get_mb_per_sec << "\n";
+    }
+
+    test15_file.close();
+
+    // Test 16: sequential throughput of the logical volume by chunk size
+    ofstream test16_file("output_chunk.csv");
+    if (!test16_file.is_open()) {
+        cerr << "Error opening file!" << endl;
+        return 1;
+    }
+    test16_file << "chunk_size,put_mb_per_sec,get_mb_per_sec\n";
+
+    for (int chunk_size : {4096, 65536, 262144, 1048576}) {
+        RAID6::RAID6 raid6;
+        RAID6::Options options;
+        options.chunk_size = chunk_size;
+        raid6.init("data_chunk/", 6, 1536, 4096, options);
+        // a whole stripe of the largest chunk
+        const size_t io_size = 4 * 1024 * 1024;
+        size_t total = raid6.get_volume_size();
+        vector<char> written(total), read_back(total);
+        srand(20);
+        for (auto &c : written) c = rand();
+
+        auto start = chrono::steady_clock::now();
+        for (size_t pos = 0; pos + io_size <= total; pos += io_size)
+            raid6.put_logical(pos, io_size, written.data() + pos);
+        auto end = chrono::steady_clock::now();
+        double put_mb_per_sec = total / 1e6 / chrono::duration<double>(end - start).count();
+
+        start = chrono::steady_clock::now();
+        for (size_t pos = 0; pos + io_size <= total; pos += io_size)
+            raid6.get_logical(pos, io_size, read_back.data() + pos);
+        end = chrono::steady_clock::now();
+        double get_mb_per_sec = total / 1e6 / chrono::duration<double>(end - start).count();
+
+        bool ok = raid6.check() == 0 && read_back == written;
+        cout << "chunk size: " << chunk_size << " put: " << put_mb_per_sec << "MB/s get: " << get_mb_per_sec << "MB/s " << (ok ? "ok" : "MISMATCH") << endl;
+        if (!ok) {
+            return 1;
+        }
+        test16_file << chunk_size << "," << put_mb_per_sec << "," << get_mb_per_sec << "\n";
+    }
+
+    test16_file.close();
+
+    // Test 17: array creation time by capacity, sparse vs preallocated disks
+    ofstream test17_file("output_create.csv");
+    if (!test17_file.is_open()) {
+        cerr << "Error opening file!" << endl;
+        return 1;
+    }
+    test17_file << "num_blocks,preallocate,init_time_ms\n";
+
+    for (int num_blocks : {1024, 16384, 262144})
+    for (bool preallocate : {false, true}) {
+        RAID6::RAID6 raid6;
+        RAID6::Options options;
+        options.preallocate = preallocate;
+        auto start = chrono::steady_clock::now();
+        bool ok = raid6.init("data_create/", 6, num_blocks, 4096, options) == 0;
+        auto end = chrono::steady_clock::now();
+        double init_time_ms = chrono::duration<double, milli>(end - start).count();
+
+        // a new array reads as zeros from start to end, its last block takes a write
+        const size_t span = 1024 * 1024;
+        size_t volume = raid6.get_volume_size();
+        vector<char> back(span), zeros(span, 0), last(raid6.block_size, 0x5a);
+        ok = ok && raid6.get_logical(0, span, back.data()) == 0 && back == zeros;
+        ok = ok && raid6.get_logical(volume - span, span, back.data()) == 0 && back == zeros;
+        ok = ok && raid6.put_logical(volume - last.size(), last.size(), last.data()) == 0;
+        back.resize(last.size());
+        ok = ok && raid6.get_logical(volume - last.size(), last.size(), back.data()) == 0 && back == last;
+        cout << "num blocks: " << num_blocks << " preallocate: " << preallocate << " init: " << init_time_ms << "ms " << (ok ? "ok" : "MISMATCH") << endl;
+        if (!ok) {
+            return 1;
+        }
+        test17_file << num_blocks << "," << preallocate << "," << init_time_ms << "\n";
+    }
+
+    test17_file.close();
+
+    // Test 18: growing the disks and reshaping onto an added disk
+    ofstream test18_file("output_reshape.csv");
+    if (!test18_file.is_open()) {
+        cerr << "Error opening file!" << endl;
+        return 1;
+    }
+    test18_file << "num_disks,grow_time_ms,reshape_mb_per_sec\n";
+
+    for (int num_disks : {4, 6, 8}) {
+        RAID6::RAID6 raid6;
+        RAID6::Options options;
+        raid6.init("data_reshape/", num_disks, 2048, 4096, options);
+        vector<char> written(raid6.get_volume_size());
+        srand(22);
+        for (auto &c : written) c = rand();
+        raid6.put_logical(0, written.size(), written.data());
+
+        auto start = chrono::steady_clock::now();
+        raid6.grow(4096);
+        auto end = chrono::steady_clock::now();
+        double grow_time_ms = chrono::duration<double, milli>(end - start).count();
+
+        // the data where it was, the new rows zero
+        auto holds = [&](size_t volume) {
+            vector<char> back(volume);
+            return raid6.get_volume_size() == volume && raid6.check() == 0 && raid6.get_logical(0, volume, back.data()) == 0 &&
+                   memcmp(back.data(), written.data(), written.size()) == 0 &&
+                   std::all_of(back.begin() + written.size(), back.end(), [](char c) { return c == 0; });
+        };
+        size_t moved = raid6.get_volume_size();
+        bool ok = moved == written.size() * 2 && holds(moved);
+        start = chrono::steady_clock::now();
+        raid6.add_disk(RAID6::RebuildOptions());
+        end = chrono::steady_clock::now();
+        double reshape_mb_per_sec = moved / 1e6 / chrono::duration<double>(end - start).count();
+
+        ok = ok && holds(moved / (num_disks - 2) * (num_disks - 1));
+        cout << "num disks: " << num_disks << " grow: " << grow_time_ms << "ms reshape: " << reshape_mb_per_sec << "MB/s " << (ok ? "ok" : "MISMATCH") << endl;
+        if (!ok) {
+            return 1;
+        }
+        test18_file << num_disks << "," << grow_time_ms << "," << reshape_mb_per_sec << "\n";
+    }
+
+    test18_file.close();
+
+    // Test 19: reopening an existing array from its superblocks
+    ofstream test19_file("output_load.csv");
+    if (!test19_file.is_open()) {
+        cerr << "Error opening file!" << endl;
+        return 1;
+    }
+    test19_file << "num_disks,load_time_us\n";
+
+    for (int num_disks : {4, 8, 16}) {
+        // a megabyte written before the array is closed, read back after the loads
+        vector<char> written(1024 * 1024), back(written.size());
+        srand(23);
+        for (auto &c : written) c = rand();
+        {
+            RAID6::RAID6 raid6;
+            raid6.init("data_load/", num_disks, 1024, 4096);
+            raid6.put_logical(0, written.size(), written.data());
+        }
+        const int loads = 100;
+        bool ok = true;
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < loads; ++i) {
+            RAID6::RAID6 raid6;
+            ok = raid6.load("data_load/") == 0 && raid6.num_disks == num_disks && ok;
+        }
+        auto end = chrono::steady_clock::now();
+        double load_time_us = chrono::duration<double, micro>(end - start).count() / loads;
+
+        RAID6::RAID6 raid6;
+        ok = ok && raid6.load("data_load/") == 0 && raid6.check() == 0 && raid6.get_logical(0, back.size(), back.data()) == 0 && back == written;
+        cout << "num disks: " << num_disks << " load: " << load_time_us << "us " << (ok ? "ok" : "MISMATCH") << endl;
+        if (!ok) {
+            return 1;
+        }
+        test19_file << num_disks << "," << load_time_us << "\n";
+    }
+
+    test19_file.close();
 
     return 0;
 }
@@ -2,7 +2,24 @@
 #include <string>
 #include <vector>
 #include <fstream>
+#include <atomic>
+#include <deque>
+#include <future>
+#include <memory>
+#include <cstdio>
+#include <filesystem>
 #include "parity.hpp"
+#include "storage.hpp"
+#include "arena.hpp"
+#include "stripe_cache.hpp"
+#include "rebuild.hpp"
+#include "scrub.hpp"
+#include "checksum.hpp"
+#include "bitmap.hpp"
+#include "stripe_lock.hpp"
+#include "batch.hpp"
+#include "async.hpp"
+#include "superblock.hpp"
 
 using std::cerr;
 using std::cout;
@@ -23,16 +40,24 @@ namespace RAID6
         // |   3    |   A3   |   P3   |   Q3   |   D3   |   C3   |   B3   |
         // |   4    |   P4   |   Q4   |   D4   |   C4   |   B4   |   A4   |
         // |   5    |   Q5   |   D5   |   C5   |   B5   |   A5   |   P5   |
+        // A stripe is chunk_size / block_size rows, each disk holds one chunk of
+        // consecutive blocks of it, and the rows of a stripe share its P and Q disks.
     public:
+        int num_disks;
+        int num_blocks;
+        int block_size;
+        int chunk_size;
+
         void print()
         {
             cout << "RAID6" << endl;
             cout << "path: " << path << endl;
             cout << "num_disks: " << num_disks << endl;
             cout << "block_size: " << block_size << endl;
+            cout << "chunk_size: " << chunk_size << endl;
         }
 
-        int init(string path, int num_disks, int num_blocks, int block_size)
+        int init(string path, int num_disks, int num_blocks, int block_size, Options options = Options())
         {
             if (path.back() != '/')
             {
@@ -42,31 +67,46 @@ namespace RAID6
             this->num_disks = num_disks;
             this->block_size = block_size;
             this->num_blocks = num_blocks;
-
-            create_folders(path, num_disks);
-            parity = new Parity(num_disks);
-
-            // write config file
-            fstream config_file(get_config_path(), std::ios::out);
-            if (!config_file.is_open())
+            this->chunk_size = options.chunk_size ? options.chunk_size : block_size;
+            this->options = options;
+            data_offset = SUPERBLOCK_SIZE;
+            generation = 0;
+            reshape_disks = 0;
+            if (chunk_size % block_size || num_blocks % chunk_blocks())
             {
-                cerr << "Error: failed to open config file" << endl;
+                cerr << "Error: chunk_size must be a multiple of block_size dividing the disks" << endl;
                 return -1;
             }
-            config_file << num_disks << endl;
-            config_file << num_blocks << endl;
-            config_file << block_size << endl;
-            config_file.close();
-            return 0;
+
+            if (create_folders(path, num_disks))
+                return -1;
+            delete parity;
+            parity = new Parity(num_disks);
+            if (open_disks(true))
+                return -1;
+            return write_metadata();
         }
 
         ~RAID6()
         {
+            // operations still queued run first
+            delete executor;
+            // nothing cached is lost on destruction
+            if (cache)
+                flush();
+            // a clean shutdown leaves nothing to resync
+            if (bitmap)
+                clear_intent();
+            delete bitmap;
+            delete cache;
+            delete storage;
+            delete arena;
             delete parity;
         }
 
-        // recover the data from the config file
-        int load(string path)
+        // open an array from the newest superblock of its disks, or the config
+        // file of an array from before superblocks
+        int load(string path, Options options = Options())
         {
             if (path.back() != '/')
             {
@@ -74,22 +114,288 @@ namespace RAID6
             }
             this->path = path;
 
-            // read config file
-            fstream config_file(get_config_path(), std::ios::in);
-            if (!config_file.is_open())
+            Superblock sb{};
+            if (read_superblocks(sb))
             {
-                cerr << "Error: failed to open config file" << endl;
+                if (sb.layout != LAYOUT_ROTATING)
+                {
+                    cerr << "Error: unknown parity layout " << sb.layout << endl;
+                    return -1;
+                }
+                num_disks = sb.num_disks;
+                num_blocks = sb.num_blocks;
+                block_size = sb.block_size;
+                chunk_size = sb.chunk_size;
+                generation = sb.generation;
+                data_offset = SUPERBLOCK_SIZE;
+            }
+            else if (read_config() == 0)
+            {
+                generation = 0;
+                data_offset = 0;
+            }
+            else
                 return -1;
+            this->options = options;
+            delete parity;
+            parity = new Parity(num_disks);
+
+            // a reshape a crash cut short goes on in the layout it left
+            int old_disks, row, end;
+            bool backup;
+            reshape_disks = 0;
+            reshape_row = 0;
+            if (read_reshape_checkpoint(old_disks, row, end, backup))
+            {
+                // written before the metadata named the new disk, nothing moved yet
+                if (old_disks == num_disks)
+                    remove_reshape_files();
+                else
+                {
+                    reshape_disks = old_disks;
+                    reshape_row = row;
+                }
             }
-            config_file >> num_disks;
-            config_file >> num_blocks;
-            config_file >> block_size;
-            config_file.close();
+            if (open_disks())
+                return -1;
+            if (reshape_disks && backup)
+                return restore_reshape_window(row, end);
             return 0;
         }
 
+        // write every cached change back to the disks, parity included
+        int flush()
+        {
+            ReadLock layout_lock(layout_mutex);
+            return flush_cache();
+        }
+
+        // flush the cache and every disk file to stable storage
+        int sync()
+        {
+            ReadLock layout_lock(layout_mutex);
+            if (flush_cache())
+                return -1;
+            for (auto &checksum : checksums)
+            {
+                if (checksum.sync())
+                    return -1;
+            }
+            if (bitmap)
+                return clear_intent();
+            return storage->sync();
+        }
+
+        // Take a member disk out of service. Reads of it are rebuilt in memory
+        // from the other disks of the row, as for a disk found missing or unreadable.
+        void fail_disk(int disk)
+        {
+            ReadLock layout_lock(layout_mutex);
+            failed[disk] = true;
+            rebuilding[disk] = false;
+        }
+
+        bool is_failed(int disk)
+        {
+            ReadLock layout_lock(layout_mutex);
+            return failed[disk];
+        }
+
+        // Rebuild every stripe of one or two replaced disks from the others,
+        // a missing disk file is created first. Workers take the stripes in windows
+        // of checkpoint_interval; after each window the disks are synced and the
+        // position is saved, so a rebuild cut short resumes there when run again.
+        // Reads of the disks are served by reconstruction until the rebuild is done;
+        // writes reach them all along, so rows the rebuild has passed stay current.
+        // The geometry is locked one window at a time and progress is reported
+        // outside it; grow() and add_disk() are refused until the rebuild ends.
+        int rebuild_disk(int disk, int disk2 = -1, RebuildOptions rebuild_options = RebuildOptions())
+        {
+            vector<int> targets = {disk};
+            if (disk2 >= 0 && disk2 != disk)
+                targets.push_back(disk2);
+            int first;
+            {
+                ReadLock layout_lock(layout_mutex);
+                if (reshape_disks)
+                {
+                    cerr << "Error: can not rebuild during a reshape" << endl;
+                    return -1;
+                }
+                int num_failed = targets.size();
+                for (int i = 0; i < num_disks; ++i)
+                {
+                    if (failed[i] && i != disk && i != disk2)
+                        num_failed++;
+                }
+                for (int target : targets)
+                {
+                    if (target < 0 || target >= num_disks)
+                    {
+                        cerr << "Error: no disk " << target << endl;
+                        return -1;
+                    }
+                }
+                if (num_failed > 2)
+                {
+                    cerr << "Error: more than two failed disks" << endl;
+                    return -1;
+                }
+                for (int target : targets)
+                {
+                    if (prepare_disk(target) || storage->reopen(target, get_disk_path(target)))
+                        return -1;
+                    if (data_offset && write_superblock(target))
+                        return -1;
+                    failed[target] = true;
+                    // written from here on, also if the rebuild is cut short and resumed
+                    rebuilding[target] = true;
+                }
+                first = read_checkpoint(targets);
+                rebuilds++;
+            }
+            int status = rebuild_windows(targets, first, rebuild_options);
+            rebuilds--;
+            return status;
+        }
+
+        // Add rows at the end of every disk. The new rows read as zeros, which
+        // their zero P and Q match, so the disk files are only extended; the metadata
+        // names the new size last, a grow cut short keeps the old one.
+        int grow(int new_num_blocks)
+        {
+            WriteLock layout_lock(layout_mutex);
+            if (reshape_disks)
+            {
+                cerr << "Error: can not grow during a reshape" << endl;
+                return -1;
+            }
+            if (rebuilds)
+            {
+                cerr << "Error: can not grow during a rebuild" << endl;
+                return -1;
+            }
+            if (new_num_blocks <= num_blocks || new_num_blocks % chunk_blocks())
+            {
+                cerr << "Error: the new size must be larger and a multiple of the chunk" << endl;
+                return -1;
+            }
+            int old_num_blocks = num_blocks;
+            num_blocks = new_num_blocks;
+            ArenaBlocks bufs(*arena);
+            uint32_t zero_crc = crc32c(bufs.get_zeroed(), block_size);
+            for (int i = 0; i < num_disks; ++i)
+            {
+                // a failed disk is sized by rebuild_disk
+                bool resized = failed[i] || (prepare_disk(i) == 0 && storage->reopen(i, get_disk_path(i)) == 0);
+                if (!resized || (!checksums.empty() && checksums[i].extend(num_blocks, zero_crc)))
+                {
+                    num_blocks = old_num_blocks;
+                    return -1;
+                }
+            }
+            if (bitmap && bitmap->open(path + "bitmap", num_blocks, options.intent_region_blocks))
+                return -1;
+            return write_metadata();
+        }
+
+        // Add a member disk and restripe the array over it. The logical volume
+        // keeps its content and grows by num_blocks blocks when the reshape is
+        // complete; per disk positions can not be used until then. The reshape
+        // runs as reshape() does, on the calling thread.
+        int add_disk(RebuildOptions rebuild_options = RebuildOptions())
+        {
+            {
+                WriteLock layout_lock(layout_mutex);
+                if (reshape_disks)
+                {
+                    cerr << "Error: a reshape is running, resume it with reshape()" << endl;
+                    return -1;
+                }
+                if (rebuilds)
+                {
+                    cerr << "Error: can not add a disk during a rebuild" << endl;
+                    return -1;
+                }
+                if (std::find(failed.begin(), failed.end(), true) != failed.end())
+                {
+                    cerr << "Error: a reshape needs every disk" << endl;
+                    return -1;
+                }
+                // the cache holds rows in the layout they had, it is set aside until the end
+                if (flush_cache())
+                    return -1;
+                delete cache;
+                cache = nullptr;
+                // the checkpoint goes first, a crash before the metadata names the
+                // new disk leaves the array as it was
+                if (write_reshape_checkpoint(num_disks, 0, 0, false))
+                    return -1;
+                reshape_disks = num_disks;
+                reshape_row = 0;
+                num_disks++;
+                if (prepare_disk(num_disks - 1) || open_members() || write_metadata())
+                {
+                    num_disks--;
+                    reshape_disks = 0;
+                    remove_reshape_files();
+                    open_members();
+                    return -1;
+                }
+            }
+            return reshape(rebuild_options);
+        }
+
+        // Move the rows of a running reshape to the new layout, also to resume one
+        // after load(). Windows of checkpoint_interval rows move one at a time,
+        // each with the array to itself; other threads' I/O runs in between.
+        // The caps on disk traffic apply, threads does not.
+        int reshape(RebuildOptions rebuild_options = RebuildOptions())
+        {
+            int interval = std::max(1, rebuild_options.checkpoint_interval);
+            interval = (interval + chunk_blocks() - 1) / chunk_blocks() * chunk_blocks();
+            Throttle bandwidth(rebuild_options.max_bytes_per_sec);
+            Throttle iops(rebuild_options.max_stripes_per_sec);
+            auto start = std::chrono::steady_clock::now();
+            int first = -1;
+            while (true)
+            {
+                int end, rows;
+                double row_bytes;
+                {
+                    WriteLock layout_lock(layout_mutex);
+                    if (!reshape_disks)
+                        return 0;
+                    if (first < 0)
+                        first = reshape_row;
+                    if (reshape_row >= num_blocks)
+                        return finish_reshape();
+                    if (std::find(failed.begin(), failed.end(), true) != failed.end())
+                    {
+                        cerr << "Error: a reshape needs every disk" << endl;
+                        return -1;
+                    }
+                    end = std::min(num_blocks, reshape_row + interval);
+                    rows = end - reshape_row;
+                    // the old rows read, the new ones written
+                    row_bytes = (double)(reshape_disks + num_disks) * block_size;
+                    if (reshape_window(reshape_row, end))
+                        return -1;
+                }
+                if (rebuild_options.progress)
+                {
+                    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    double rate = (end - first) / std::max(elapsed, 1e-9);
+                    rebuild_options.progress({end, num_blocks, elapsed, (num_blocks - end) / rate, rate * row_bytes});
+                }
+                bandwidth.acquire(rows * row_bytes);
+                iops.acquire(rows);
+            }
+        }
+
         int recover(vector<std::pair<int, int>> block_list)
         {
+            ReadLock layout_lock(layout_mutex);
             if (block_list.size() == 0)
             {
                 cerr << "Error: no block missing" << endl;
@@ -99,11 +405,11 @@ namespace RAID6
             {
                 if (is_parity_block(block_list[0].first, block_list[0].second))
                 {
-                    recover(block_list, 2);
+                    recover_case(block_list, 2);
                 }
                 else
                 {
-                    recover(block_list, 1);
+                    recover_case(block_list, 1);
                 }
             }
             else if (block_list.size() == 2)
@@ -118,15 +424,15 @@ namespace RAID6
                 is_parity_2 = is_parity_block(block_list[1].first, block_list[1].second);
                 if (is_parity_1 && is_parity_2)
                 {
-                    recover(block_list, 4);
+                    recover_case(block_list, 4);
                 }
                 else if (!is_parity_1 && !is_parity_2)
                 {
-                    recover(block_list, 3);
+                    recover_case(block_list, 3);
                 }
                 else
                 {
-                    recover(block_list, 5);
+                    recover_case(block_list, 5);
                 }
             }
             else
@@ -137,141 +443,157 @@ namespace RAID6
             return 0;
         }
 
-        // to be tested
         int recover(vector<std::pair<int, int>> block_list, int case_num)
         {
-            if (case_num == 1)
-            {
-                // 1. one data block is missing
-                // recover from P
-                auto disk = block_list[0].first;
-                auto block = block_list[0].second;
-                rebuild_single_p(disk, block);
-            }
-            else if (case_num == 2)
-            {
-                // 2. one parity block is missing
-                // just recalculate the parity
-                auto disk = block_list[0].first;
-                auto block = block_list[0].second;
-                char parity_block[block_size];
-                cal_parity(block, 0, parity_block);
-                write(get_parity_disk(block, 0), block, 0, block_size, parity_block);
-            }
-            else if (case_num == 3)
-            {
-                // 3. two data blocks are missing
-                assert(block_list.size() == 2);
-                assert(block_list[0].second == block_list[1].second);
-                rebuild_double(block_list[0].first, block_list[1].first, block_list[0].second);
-            }
-            else if (case_num == 4)
-            {
-                // 4. two parity blocks are missing
-                // assert(block_list.size()==2);
-                for (int i = 0; i < 2; i++)
-                {
-                    auto disk = block_list[i].first;
-                    auto block = block_list[i].second;
-                    char parity_block[block_size];
-                    cal_parity(block, i, parity_block);
-                    write(get_parity_disk(block, i), block, 0, block_size, parity_block);
-                }
-            }
-            else if (case_num == 5)
-            {
-                // 5. one data block and one parity block are missing
-                assert(block_list.size() == 2);
-                assert(block_list[0].second == block_list[1].second);
-                assert(is_parity_block(block_list[1].first, block_list[1].second));
-                // determine the policy of the missing parity block
-                int policy = 0;
-                if (get_parity_disk(block_list[0].second, 0) != block_list[1].first)
-                    policy = 1;
-
-                char policy_block[block_size];
-                if (policy == 0)
-                {
-                    rebuild_single_q(block_list[0].first, block_list[0].second);
-                    cal_parity(block_list[1].second, 0, policy_block);
-                }
-                else
-                {
-                    rebuild_single_p(block_list[0].first, block_list[0].second);
-                    cal_parity(block_list[1].second, 1, policy_block);
-                }
-                write(block_list[1].first, block_list[1].second, 0, block_size, policy_block);
-            }
-            return 0;
+            ReadLock layout_lock(layout_mutex);
+            return recover_case(block_list, case_num);
         }
 
         int check()
         {
+            ReadLock layout_lock(layout_mutex);
+            // the disks are checked, not the cache
+            if (flush_cache())
+                return -1;
             for (int block = 0; block < num_blocks; ++block)
             {
+                ReadLock row_lock(locks.get(block));
                 vector<char *> data;
-                char old_parity_blocks[2][block_size];
-                char new_parity_blocks[2][block_size];
-                for (int disk = 0; disk < num_disks; ++disk)
-                {
-                    if (!is_parity_block(disk, block))
-                    {
-                        char *data_block = new char[block_size];
-                        read(disk, block, 0, block_size, data_block);
-                        data.push_back(data_block);
-                    }
-                }
-                read(get_parity_disk(block, 0), block, 0, block_size, old_parity_blocks[0]);
-                read(get_parity_disk(block, 1), block, 0, block_size, old_parity_blocks[1]);
-                parity->calculate_parity(policies[0], block_size, data, new_parity_blocks[0]);
-                parity->calculate_parity(policies[1], block_size, data, new_parity_blocks[1]);
-
-                for (int i = 0; i < data.size(); ++i)
-                {
-                    delete[] data[i];
-                }
+                ArenaBlocks bufs(*arena);
+                char *new_parity_blocks[2] = {bufs.get(), bufs.get()};
+                // every block of the row in one batch, parity last
+                vector<int> disks = data_disks(block);
+                disks.push_back(get_parity_disk(block, 0));
+                disks.push_back(get_parity_disk(block, 1));
+                if (!load_blocks(block, disks, data, bufs))
+                    return -1;
+                char *old_parity_blocks[2] = {data[data.size() - 2], data[data.size() - 1]};
+                data.resize(data.size() - 2);
+                parity->gen_syndrome(block_size, data, new_parity_blocks[0], new_parity_blocks[1]);
+                bool match = memcmp(old_parity_blocks[0], new_parity_blocks[0], block_size) == 0 &&
+                             memcmp(old_parity_blocks[1], new_parity_blocks[1], block_size) == 0;
 
-                // TODO: determine which parity is correct
-                for (int i = 0; i < 2; ++i)
+                // scrub() tells which block is bad
+                if (!match)
                 {
-                    for (int j = 0; j < block_size; ++j)
-                    {
-                        if (old_parity_blocks[i][j] != new_parity_blocks[i][j])
-                        {
-                            cerr << "Error: parity check failed" << endl;
-                            return -1;
-                        }
-                    }
+                    cerr << "Error: parity check failed" << endl;
+                    return -1;
                 }
             }
             return 0;
         }
 
+        // Verify every row against its parity on a pool of workers, each holding
+        // one row in arena buffers at a time. A single bad block in a row is located
+        // from the P/Q syndromes and rewritten when repair is set, rows with more
+        // damage are reported only. Returns -1 on I/O errors, findings go to report.
+        int scrub(ScrubReport &report, ScrubOptions scrub_options = ScrubOptions())
+        {
+            ReadLock layout_lock(layout_mutex);
+            // the disks are scrubbed, not the cache
+            if (flush_cache())
+                return -1;
+            report = ScrubReport();
+            // every row has a block on every disk, none can be verified with one failed
+            if (std::find(failed.begin(), failed.end(), true) != failed.end())
+            {
+                report.stripes_skipped = num_blocks;
+                return 0;
+            }
+            int num_threads = scrub_options.threads;
+            if (num_threads <= 0)
+                num_threads = std::max(1u, std::thread::hardware_concurrency());
+            ThreadPool pool(num_threads);
+            Throttle bandwidth(scrub_options.max_bytes_per_sec);
+            double stripe_bytes = (double)num_disks * block_size;
+            std::atomic<int> next(0);
+            std::mutex report_mutex;
+            Completion completion(num_threads);
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < num_threads; ++i)
+            {
+                pool.push([&]()
+                          {
+                              int status = 0;
+                              for (int block = next++; block < num_blocks && status == 0; block = next++)
+                              {
+                                  bandwidth.acquire(stripe_bytes);
+                                  vector<ScrubError> errors;
+                                  WriteLock row_lock(locks.get(block));
+                                  if (scrub_row(block, scrub_options.repair, errors))
+                                  {
+                                      status = -1;
+                                      break;
+                                  }
+                                  row_lock.unlock();
+                                  std::lock_guard<std::mutex> lock(report_mutex);
+                                  report.stripes_scanned++;
+                                  for (auto &error : errors)
+                                  {
+                                      report.errors.push_back(error);
+                                      if (error.repaired)
+                                          report.repaired++;
+                                      if (error.disk < 0)
+                                          report.unrecoverable++;
+                                  }
+                              }
+                              completion.done(status); });
+            }
+            int status = completion.wait();
+            std::sort(report.errors.begin(), report.errors.end(), [](const ScrubError &a, const ScrubError &b)
+                      { return a.block < b.block; });
+            report.elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            report.bytes_per_sec = report.stripes_scanned * stripe_bytes / std::max(report.elapsed, 1e-9);
+            return status;
+        }
+
         // wrapper functions for read and write
         // should be able to handle parity and data larger than block size
+        // get, put, put_stripe and recover may be called from many threads at once:
+        // a row is read under a shared lock and updated under an exclusive one, so
+        // different rows proceed in parallel and a parity update is atomic.
         int get(int disk, size_t position, int data_len, char *data)
         {
+            ReadLock layout_lock(layout_mutex);
+            if (check_disk_range(disk, position, data_len))
+                return -1;
+
             // get the starting block and offset
             int block, offset;
             data_position_to_block_offset(disk, position, block, offset);
 
             // start reading data
             int data_offset = 0;
+            vector<std::pair<int, int>> repairs;
             while (data_len > 0)
             {
                 int len = std::min(data_len, block_size - offset);
-                read(disk, block, offset, len, data + data_offset);
+                ReadLock row_lock(locks.get(block));
+                CachedStripe *stripe = nullptr;
+                if (cache && !is_parity_block(disk, block))
+                {
+                    std::lock_guard<std::mutex> lock(cache_mutex);
+                    stripe = cache->find(block);
+                }
+                char *cached = stripe ? stripe->data[data_index(disk, block)] : nullptr;
+                if (cached)
+                    memcpy(data + data_offset, cached + offset, len);
+                else if (read_data(disk, block, offset, len, data + data_offset, &repairs))
+                    return -1;
                 data_len -= len;
                 data_offset += len;
-                block++;
+                block = next_data_block(disk, block);
                 offset = 0;
             }
-            return 0;
+            return repair_blocks(repairs);
         }
 
-        // TODO: handle new block creation, #blocks should be written to config file
         int put(int disk, size_t position, int data_len, char *data)
         {
+            ReadLock layout_lock(layout_mutex);
+            if (check_disk_range(disk, position, data_len))
+                return -1;
+
             // get the starting block and offset
             int block, offset;
             data_position_to_block_offset(disk, position, block, offset);
@@ -281,332 +603,2261 @@ namespace RAID6
             while (data_len > 0)
             {
                 int len = std::min(data_len, block_size - offset);
-                int rs_index = 0;
-                for (int i = 0; i < disk; ++i)
-                {
-                    if (!is_parity_block(i, block))
-                        rs_index++;
-                }
-                // load old data
-                char old_data[block_size];
-                read(disk, block, offset, len, old_data);
-
-                // calculate parity
-                for (int policy = 0; policy < 2; policy++)
-                {
-                    char old_parity[block_size];
-                    read(get_parity_disk(block, policy), block, offset, len, old_parity);
-                    parity->update_block_parity(policies[policy], len, old_data, data + data_offset, old_parity, rs_index);
-                    write(get_parity_disk(block, policy), block, offset, len, old_parity);
-                }
-
-                // write data
-                write(disk, block, offset, len, data + data_offset);
+                if (put_block(disk, block, offset, len, data + data_offset))
+                    return -1;
+                if (cache && trim_cache())
+                    return -1;
                 data_len -= len;
                 data_offset += len;
-                block++;
+                block = next_data_block(disk, block);
                 offset = 0;
             }
-            return 0;
+            return settle_intent();
         }
 
-        int put_no_parity(int disk, size_t position, int data_len, char *data)
+        // Write whole data blocks of one row. data[i] is the new content of the i-th
+        // data block of the row, nullptr leaves that block as it is.
+        // The disks are written directly, cached copies of the blocks are updated.
+        int put_stripe(int block, const vector<char *> &data)
         {
-            write(disk, position / block_size, position % block_size, data_len, data);
-            return 0;
+            ReadLock layout_lock(layout_mutex);
+            {
+                WriteLock row_lock(locks.get(block));
+                if (cache)
+                {
+                    std::lock_guard<std::mutex> lock(cache_mutex);
+                    CachedStripe *stripe = cache->find(block);
+                    for (int i = 0; stripe && i < (int)data.size(); ++i)
+                    {
+                        if (data[i] && stripe->data[i])
+                        {
+                            memcpy(stripe->data[i], data[i], block_size);
+                            cache->mark_clean(stripe, i);
+                        }
+                    }
+                }
+                if (write_stripe(block, data))
+                    return -1;
+            }
+            return settle_intent();
         }
 
-    private:
-        string path;
-        int num_disks;
-        int num_blocks;
-        int block_size;
-        string policies[2] = {"XOR", "RS"};
-        Parity *parity;
-        string get_disk_path(int disk)
+        // Read many ranges at once, each as with get(). The ranges are cut at
+        // block boundaries and grouped by row, and the blocks of a window of rows
+        // are read in one batch, contiguous ones of a disk with one preadv.
+        int get_batch(const vector<Extent> &extents)
         {
-            return path + "disk" + std::to_string(disk);
+            ReadLock layout_lock(layout_mutex);
+            vector<Piece> pieces;
+            if (split_extents(extents, pieces))
+                return -1;
+            return get_pieces(pieces);
         }
 
-        string get_config_path()
+        // Write many ranges at once, each as with put(); a later
+        // range wins where ranges overlap. Per window of rows every touched row gets
+        // one parity update, and all reads and all writes go out as one batch each,
+        // contiguous blocks of a disk with one preadv/pwritev.
+        int put_batch(const vector<Extent> &extents)
         {
-            return path + "config";
+            ReadLock layout_lock(layout_mutex);
+            vector<Piece> pieces;
+            if (split_extents(extents, pieces))
+                return -1;
+            return put_pieces(pieces);
         }
 
-        int get_parity_disk(int block, int policy)
+        // bytes of data a disk holds, its chunks less its P and Q chunks
+        size_t get_disk_data_size(int disk)
         {
-            return ((block + 1) * (num_disks - 1) - 1 + policy) % num_disks;
+            ReadLock layout_lock(layout_mutex);
+            return disk_data_size(disk);
         }
 
-        bool is_parity_block(int disk, int block)
+        // bytes of the logical volume, the old size until a reshape completes
+        size_t get_volume_size()
         {
-            return get_parity_disk(block, 0) == disk || get_parity_disk(block, 1) == disk;
+            ReadLock layout_lock(layout_mutex);
+            return volume_size();
         }
 
-        void data_position_to_block_offset(int disk, size_t position, int &block, int &offset)
+        // Read the logical volume. Its chunks go to the data disks of a stripe in
+        // turn, data index order, then on to the next stripe, so sequential I/O
+        // spreads over every disk in runs of chunk_size.
+        int get_logical(size_t position, size_t data_len, char *data)
         {
-            offset = position % block_size;
-            int num_data_block = position / block_size;
-            block = num_data_block / (num_disks - 2) * num_disks;
-            int count = num_data_block % (num_disks - 2);
-            for (int i = 0; i < num_disks && count != 0; i++)
-            {
-                block++;
-                if (is_parity_block(disk, block))
-                    count--;
-            }
+            ReadLock layout_lock(layout_mutex);
+            vector<Piece> pieces;
+            if (logical_pieces(position, data_len, data, pieces))
+                return -1;
+            return get_pieces(pieces);
         }
 
-        int create_folders(string path, int num_disks)
+        // Write the logical volume, laid out as for get_logical. Rows written
+        // whole become full stripe writes that read nothing.
+        int put_logical(size_t position, size_t data_len, char *data)
         {
-            // delete the directory if it already exists
-            string command = "rm -rf " + path;
-            system(command.c_str());
+            ReadLock layout_lock(layout_mutex);
+            vector<Piece> pieces;
+            if (logical_pieces(position, data_len, data, pieces))
+                return -1;
+            return put_pieces(pieces);
+        }
 
-            // Create the directory
-            command = "mkdir -p " + path;
-            system(command.c_str());
+        // The blocking calls run on an internal pool of options.async_threads
+        // workers. The future holds their return value, the callback gets it with
+        // the latency of the operation. Buffers must live until completion.
+        std::future<int> async_get(int disk, size_t position, int data_len, char *data, AsyncCallback callback = nullptr)
+        {
+            return submit_async([=]()
+                                { return get(disk, position, data_len, data); },
+                                callback);
+        }
 
-            // Create config file
-            string config_path = path + "config";
-            fstream config_file(config_path, std::ios::out);
+        std::future<int> async_put(int disk, size_t position, int data_len, char *data, AsyncCallback callback = nullptr)
+        {
+            return submit_async([=]()
+                                { return put(disk, position, data_len, data); },
+                                callback);
+        }
+
+        std::future<int> async_recover(vector<std::pair<int, int>> block_list, AsyncCallback callback = nullptr)
+        {
+            return submit_async([=]()
+                                { return recover(block_list); },
+                                callback);
+        }
+
+        // raw write that leaves parity and checksums alone, e.g. to simulate corruption
+        int put_no_parity(int disk, size_t position, int data_len, char *data)
+        {
+            ReadLock layout_lock(layout_mutex);
+            WriteLock row_lock(locks.get(position / block_size));
+            write(disk, position / block_size, position % block_size, data_len, data, false);
+            return 0;
+        }
+
+    private:
+        // run an operation on the executor, created with the first one
+        std::future<int> submit_async(std::function<int()> operation, AsyncCallback callback)
+        {
+            auto promise = std::make_shared<std::promise<int>>();
+            std::future<int> future = promise->get_future();
+            auto start = std::chrono::steady_clock::now();
+            {
+                std::lock_guard<std::mutex> lock(executor_mutex);
+                if (!executor)
+                    executor = new ThreadPool(options.async_threads > 0 ? options.async_threads : options.queue_depth);
+            }
+            executor->push([=]()
+                           {
+                               int status = operation();
+                               double latency = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                               if (callback)
+                                   callback({status, latency});
+                               promise->set_value(status); });
+            return future;
+        }
+
+        // the part of an extent in one block
+        struct Piece
+        {
+            int disk;
+            int block;
+            int offset;
+            int len;
+            char *data;
+        };
+
+        // rows a batch locks and holds buffers for at a time
+        static constexpr int BATCH_WINDOW_ROWS = 64;
+
+        // the extents cut at block boundaries, by row and in extent order within a row
+        int split_extents(const vector<Extent> &extents, vector<Piece> &pieces)
+        {
+            pieces.reserve(extents.size());
+            for (auto &extent : extents)
+            {
+                if (check_disk_range(extent.disk, extent.position, extent.len))
+                    return -1;
+                int block, offset;
+                data_position_to_block_offset(extent.disk, extent.position, block, offset);
+                for (int done = 0; done < extent.len; block = next_data_block(extent.disk, block), offset = 0)
+                {
+                    int len = std::min(extent.len - done, block_size - offset);
+                    pieces.push_back({extent.disk, block, offset, len, extent.data + done});
+                    done += len;
+                }
+            }
+            sort_pieces(pieces);
+            return 0;
+        }
+
+        // by row, in order of the range within a row
+        void sort_pieces(vector<Piece> &pieces)
+        {
+            std::stable_sort(pieces.begin(), pieces.end(), [](const Piece &a, const Piece &b)
+                             { return a.block < b.block; });
+        }
+
+        // a logical range cut into blocks, by row
+        int logical_pieces(size_t position, size_t data_len, char *data, vector<Piece> &pieces)
+        {
+            if (position + data_len > volume_size())
+            {
+                cerr << "Error: logical range beyond the volume" << endl;
+                return -1;
+            }
+            // the rows a reshape has reached hold the start of the volume
+            size_t reshaped = reshape_disks ? (size_t)reshape_row * (num_disks - 2) : SIZE_MAX;
+            size_t done = 0;
+            while (done < data_len)
+            {
+                size_t lba = (position + done) / block_size;
+                int offset = (position + done) % block_size;
+                int len = std::min(data_len - done, (size_t)(block_size - offset));
+                int num_data = (lba < reshaped ? num_disks : reshape_disks) - 2;
+                size_t chunk = lba / chunk_blocks();
+                int block = chunk / num_data * chunk_blocks() + lba % chunk_blocks();
+                pieces.push_back({data_disk(block, chunk % num_data), block, offset, len, data + done});
+                done += len;
+            }
+            // a chunk runs down the rows of its stripe before the next disk's
+            if (chunk_blocks() > 1)
+                sort_pieces(pieces);
+            return 0;
+        }
+
+        int get_pieces(const vector<Piece> &pieces)
+        {
+            for (size_t first = 0; first < pieces.size();)
+            {
+                size_t end = window_end(pieces, first);
+                vector<std::pair<int, int>> repairs;
+                if (get_window(pieces, first, end, repairs) || repair_blocks(repairs))
+                    return -1;
+                first = end;
+            }
+            return 0;
+        }
+
+        int put_pieces(const vector<Piece> &pieces)
+        {
+            for (size_t first = 0; first < pieces.size();)
+            {
+                size_t end = window_end(pieces, first);
+                if (put_window(pieces, first, end))
+                    return -1;
+                if (cache && trim_cache())
+                    return -1;
+                first = end;
+            }
+            return settle_intent();
+        }
+
+        // the end of the window of rows starting at pieces[first]
+        size_t window_end(const vector<Piece> &pieces, size_t first)
+        {
+            int rows = 0;
+            size_t end = first;
+            for (; end < pieces.size(); ++end)
+            {
+                if (end == first || pieces[end].block != pieces[end - 1].block)
+                {
+                    if (rows == BATCH_WINDOW_ROWS)
+                        break;
+                    rows++;
+                }
+            }
+            return end;
+        }
+
+        vector<int> window_blocks(const vector<Piece> &pieces, size_t first, size_t end)
+        {
+            vector<int> blocks;
+            for (size_t k = first; k < end; ++k)
+            {
+                if (blocks.empty() || blocks.back() != pieces[k].block)
+                    blocks.push_back(pieces[k].block);
+            }
+            return blocks;
+        }
+
+        // blocks that failed their checksum are served rebuilt and added to repairs,
+        // to be written back once the shared row locks are released
+        int get_window(const vector<Piece> &pieces, size_t first, size_t end, vector<std::pair<int, int>> &repairs)
+        {
+            RowLocks row_locks(locks, window_blocks(pieces, first, end), false);
+            vector<IORequest> batch;
+            vector<const Piece *> batched;
+            batch.reserve(end - first);
+            batched.reserve(end - first);
+            for (size_t k = first; k < end; ++k)
+            {
+                const Piece &piece = pieces[k];
+                char *cached = nullptr;
+                if (cache && !is_parity_block(piece.disk, piece.block))
+                {
+                    std::lock_guard<std::mutex> lock(cache_mutex);
+                    CachedStripe *stripe = cache->find(piece.block);
+                    if (stripe)
+                        cached = stripe->data[data_index(piece.disk, piece.block)];
+                }
+                if (cached)
+                {
+                    memcpy(piece.data, cached + piece.offset, piece.len);
+                }
+                else if (failed[piece.disk] || !checksums.empty())
+                {
+                    // rebuilt or verified block by block
+                    if (read_data(piece.disk, piece.block, piece.offset, piece.len, piece.data, &repairs))
+                        return -1;
+                }
+                else
+                {
+                    batch.push_back({piece.disk, block_offset(piece.block) + piece.offset, (size_t)piece.len, piece.data});
+                    batched.push_back(&piece);
+                }
+            }
+            if (load_batch(batch))
+            {
+                // read_data finds the failed disk and rebuilds its blocks
+                for (const Piece *piece : batched)
+                {
+                    if (read_data(piece->disk, piece->block, piece->offset, piece->len, piece->data, &repairs))
+                        return -1;
+                }
+                return 0;
+            }
+            for (int k = 0; k < (int)batch.size(); ++k)
+            {
+                // mapped disks hand out their pages instead of filling the buffer
+                if (batch[k].buf != batched[k]->data)
+                    memcpy(batched[k]->data, batch[k].buf, batched[k]->len);
+            }
+            return 0;
+        }
+
+        // The pieces of a window of rows, under their write locks. Each row is
+        // handled over the byte range its pieces span: the new content of every
+        // touched block is assembled in memory on top of the old one, and P and Q
+        // are updated as in write_stripe, by read-modify-write or reconstruct-write.
+        int put_window(const vector<Piece> &pieces, size_t first, size_t end)
+        {
+            vector<int> blocks = window_blocks(pieces, first, end);
+            RowLocks row_locks(locks, blocks, true);
+            if (cache)
+            {
+                for (size_t k = first; k < end; ++k)
+                {
+                    const Piece &piece = pieces[k];
+                    if (cache_write(piece.block, data_index(piece.disk, piece.block), piece.offset, piece.len, piece.data))
+                        return -1;
+                }
+                return 0;
+            }
+
+            struct RowPlan
+            {
+                int block;
+                size_t first, end;
+                // the span of the row the pieces touch
+                int lo, len;
+                // new content of the span per data index, nullptr when untouched
+                vector<char *> fresh;
+                // old content of the span per data index, read when needed
+                vector<int> old;
+                // spans not written whole by one piece, assembled on top of the old content
+                vector<bool> partial;
+                // the untouched blocks read for a reconstruct-write
+                vector<int> clean;
+                int read_p = -1, read_q = -1;
+            };
+            vector<RowPlan> plans;
+            ArenaBlocks bufs(*arena);
+            std::deque<WriteIntent> intents;
+            vector<IORequest> reads;
+            auto read_span = [&](int disk, const RowPlan &plan)
+            {
+                off_t pos = block_offset(plan.block) + plan.lo;
+                char *buf = storage->map(disk, pos) ? nullptr : bufs.get();
+                reads.push_back({disk, pos, (size_t)plan.len, buf});
+                return (int)reads.size() - 1;
+            };
+            for (size_t k = first; k < end;)
+            {
+                if (row_degraded(pieces[k].block))
+                {
+                    size_t row_end = k;
+                    while (row_end < end && pieces[row_end].block == pieces[k].block)
+                        row_end++;
+                    if (put_row_degraded(pieces, k, row_end))
+                        return -1;
+                    k = row_end;
+                    continue;
+                }
+                RowPlan plan;
+                plan.block = pieces[k].block;
+                plan.first = k;
+                plan.lo = block_size;
+                int hi = 0;
+                for (; k < end && pieces[k].block == plan.block; ++k)
+                {
+                    plan.lo = std::min(plan.lo, pieces[k].offset);
+                    hi = std::max(hi, pieces[k].offset + pieces[k].len);
+                }
+                plan.end = k;
+                plan.len = hi - plan.lo;
+                int num_data = row_disks(plan.block) - 2;
+                plan.fresh.assign(num_data, nullptr);
+                plan.old.assign(num_data, -1);
+                plan.partial.assign(num_data, true);
+                vector<int> count(num_data, 0);
+                vector<const Piece *> whole(num_data, nullptr);
+                for (size_t j = plan.first; j < plan.end; ++j)
+                {
+                    int i = data_index(pieces[j].disk, plan.block);
+                    count[i]++;
+                    if (pieces[j].offset == plan.lo && pieces[j].len == plan.len)
+                        whole[i] = &pieces[j];
+                }
+                int dirty = 0;
+                for (int i = 0; i < num_data; ++i)
+                {
+                    if (count[i])
+                        dirty++;
+                }
+                bool rmw = dirty + 2 <= num_data - dirty;
+                vector<int> row = data_disks(plan.block);
+                for (int i = 0; i < num_data; ++i)
+                {
+                    if (!count[i])
+                    {
+                        if (!rmw)
+                            plan.clean.push_back(read_span(row[i], plan));
+                        continue;
+                    }
+                    // the last piece covering the whole span leaves nothing of the old content
+                    plan.partial[i] = !whole[i];
+                    if (rmw || plan.partial[i])
+                        plan.old[i] = read_span(row[i], plan);
+                    // a single piece is written from the caller's buffer
+                    plan.fresh[i] = count[i] == 1 && whole[i] ? whole[i]->data : bufs.get();
+                }
+                if (rmw)
+                {
+                    plan.read_p = read_span(get_parity_disk(plan.block, 0), plan);
+                    plan.read_q = read_span(get_parity_disk(plan.block, 1), plan);
+                }
+                intents.emplace_back(bitmap, plan.block);
+                if (intents.back().get_status())
+                    return -1;
+                plans.push_back(std::move(plan));
+            }
+            if (load_batch(reads))
+                return -1;
+
+            vector<IORequest> writes;
+            for (auto &plan : plans)
+            {
+                vector<int> row = data_disks(plan.block);
+                int num_data = row.size();
+                off_t pos = block_offset(plan.block) + plan.lo;
+                // assemble the new spans, pieces in extent order
+                for (int i = 0; i < num_data; ++i)
+                {
+                    if (plan.fresh[i] && plan.partial[i])
+                        memcpy(plan.fresh[i], reads[plan.old[i]].buf, plan.len);
+                }
+                for (size_t j = plan.first; j < plan.end; ++j)
+                {
+                    const Piece &piece = pieces[j];
+                    char *fresh = plan.fresh[data_index(piece.disk, plan.block)];
+                    if (fresh != piece.data)
+                        memcpy(fresh + piece.offset - plan.lo, piece.data, piece.len);
+                }
+
+                char *p_block, *q_block;
+                if (plan.read_p >= 0)
+                {
+                    // read-modify-write
+                    p_block = reads[plan.read_p].buf;
+                    q_block = reads[plan.read_q].buf;
+                    for (int i = 0; i < num_data; ++i)
+                    {
+                        if (!plan.fresh[i])
+                            continue;
+                        parity->update<PolicyXOR>(plan.len, reads[plan.old[i]].buf, plan.fresh[i], p_block, i);
+                        parity->update<PolicyRS>(plan.len, reads[plan.old[i]].buf, plan.fresh[i], q_block, i);
+                    }
+                }
+                else
+                {
+                    // full stripe or reconstruct-write
+                    vector<char *> full;
+                    int next = 0;
+                    for (int i = 0; i < num_data; ++i)
+                    {
+                        full.push_back(plan.fresh[i] ? plan.fresh[i] : reads[plan.clean[next++]].buf);
+                    }
+                    p_block = storage->map(get_parity_disk(plan.block, 0), pos);
+                    q_block = storage->map(get_parity_disk(plan.block, 1), pos);
+                    if (!p_block)
+                        p_block = bufs.get();
+                    if (!q_block)
+                        q_block = bufs.get();
+                    parity->gen_syndrome(plan.len, full, p_block, q_block);
+                }
+                for (int i = 0; i < num_data; ++i)
+                {
+                    if (plan.fresh[i])
+                        writes.push_back({row[i], pos, (size_t)plan.len, plan.fresh[i]});
+                }
+                writes.push_back({get_parity_disk(plan.block, 0), pos, (size_t)plan.len, p_block});
+                writes.push_back({get_parity_disk(plan.block, 1), pos, (size_t)plan.len, q_block});
+            }
+            return store_batch(writes);
+        }
+
+        // One block of a put, under the row's write lock. Partial writes of
+        // a block update the parity from the old data (read-modify-write).
+        int put_block(int disk, int block, int offset, int len, char *data)
+        {
+            WriteLock row_lock(locks.get(block));
+            int rs_index = data_index(disk, block);
+            if (cache && !is_parity_block(disk, block))
+            {
+                // merged in the cache, parity waits for the write back
+                return cache_write(block, rs_index, offset, len, data);
+            }
+            if (len == block_size && !is_parity_block(disk, block))
+            {
+                // a whole block, let write_stripe pick the cheaper parity update
+                vector<char *> row(row_disks(block) - 2, nullptr);
+                row[rs_index] = data;
+                return write_stripe(block, row);
+            }
+            if (row_degraded(block) && !is_parity_block(disk, block))
+            {
+                vector<Piece> piece = {{disk, block, offset, len, data}};
+                return put_row_degraded(piece, 0, 1);
+            }
+            WriteIntent intent(bitmap, block);
+            if (intent.get_status())
+                return -1;
+            // load old data and parity in one batch
+            off_t pos = block_offset(block) + offset;
+            ArenaBlocks bufs(*arena);
+            vector<IORequest> batch = {
+                {disk, pos, (size_t)len, bufs.get()},
+                {get_parity_disk(block, 0), pos, (size_t)len, bufs.get()},
+                {get_parity_disk(block, 1), pos, (size_t)len, bufs.get()},
+            };
+            if (load_batch(batch))
+                return -1;
+
+            // calculate parity, in place when the parity is mapped
+            parity->update<PolicyXOR>(len, batch[0].buf, data, batch[1].buf, rs_index);
+            parity->update<PolicyRS>(len, batch[0].buf, data, batch[2].buf, rs_index);
+
+            // write parity and data in one batch
+            batch[0].buf = data;
+            return store_batch(batch);
+        }
+
+        // A full row computes P and Q from the new data alone and reads nothing,
+        // a partial row reads either the old dirty blocks and P/Q (read-modify-write)
+        // or the clean blocks (reconstruct-write), whichever is fewer reads.
+        int write_stripe(int block, const vector<char *> &data)
+        {
+            int num_data = row_disks(block) - 2;
+            assert((int)data.size() == num_data);
+            vector<int> row = data_disks(block);
+            int disk_p = get_parity_disk(block, 0);
+            int disk_q = get_parity_disk(block, 1);
+            int dirty = 0;
+            for (char *d : data)
+            {
+                if (d)
+                    dirty++;
+            }
+            if (dirty == 0)
+                return 0;
+
+            WriteIntent intent(bitmap, block);
+            if (intent.get_status())
+                return -1;
+            if (row_degraded(block))
+                return write_degraded(block, data);
+            ArenaBlocks bufs(*arena);
+            vector<IORequest> batch;
+            if (dirty + 2 <= num_data - dirty)
+            {
+                // read-modify-write: old dirty blocks, P and Q
+                vector<int> dirty_index;
+                for (int i = 0; i < num_data; ++i)
+                {
+                    if (data[i])
+                    {
+                        batch.push_back({row[i], block_offset(block), (size_t)block_size, bufs.get()});
+                        dirty_index.push_back(i);
+                    }
+                }
+                batch.push_back({disk_p, block_offset(block), (size_t)block_size, bufs.get()});
+                batch.push_back({disk_q, block_offset(block), (size_t)block_size, bufs.get()});
+                if (load_batch(batch))
+                    return -1;
+                char *p_block = batch[dirty].buf;
+                char *q_block = batch[dirty + 1].buf;
+                for (int k = 0; k < dirty; ++k)
+                {
+                    int i = dirty_index[k];
+                    parity->update<PolicyXOR>(block_size, batch[k].buf, data[i], p_block, i);
+                    parity->update<PolicyRS>(block_size, batch[k].buf, data[i], q_block, i);
+                    batch[k].buf = data[i];
+                }
+                return store_batch(batch);
+            }
+
+            // full stripe or reconstruct-write: P and Q from the complete new row
+            vector<int> clean;
+            for (int i = 0; i < num_data; ++i)
+            {
+                if (!data[i])
+                    clean.push_back(row[i]);
+            }
+            vector<char *> loaded;
+            if (!load_blocks(block, clean, loaded, bufs))
+                return -1;
+            vector<char *> full;
+            int next = 0;
+            for (int i = 0; i < num_data; ++i)
+            {
+                if (data[i])
+                {
+                    full.push_back(data[i]);
+                    batch.push_back({row[i], block_offset(block), (size_t)block_size, data[i]});
+                }
+                else
+                {
+                    full.push_back(loaded[next++]);
+                }
+            }
+            // straight into the parity pages when they are mapped
+            char *p_block = storage->map(disk_p, block_offset(block));
+            char *q_block = storage->map(disk_q, block_offset(block));
+            if (!p_block)
+                p_block = bufs.get();
+            if (!q_block)
+                q_block = bufs.get();
+            parity->gen_syndrome(block_size, full, p_block, q_block);
+            batch.push_back({disk_p, block_offset(block), (size_t)block_size, p_block});
+            batch.push_back({disk_q, block_offset(block), (size_t)block_size, q_block});
+            return store_batch(batch);
+        }
+
+        // a member of the row is out of service, its old blocks can not all be read
+        bool row_degraded(int block)
+        {
+            for (int i = 0; i < row_disks(block); ++i)
+            {
+                if (failed[i])
+                    return true;
+            }
+            return false;
+        }
+
+        // The pieces of one degraded row, under its write lock: each touched block
+        // is completed from its old content, rebuilt when its disk has failed, and
+        // the row is written as whole blocks.
+        int put_row_degraded(const vector<Piece> &pieces, size_t first, size_t end)
+        {
+            int block = pieces[first].block;
+            ArenaBlocks bufs(*arena);
+            vector<char *> data(row_disks(block) - 2, nullptr);
+            for (size_t j = first; j < end; ++j)
+            {
+                const Piece &piece = pieces[j];
+                int i = data_index(piece.disk, block);
+                if (!data[i])
+                {
+                    data[i] = bufs.get();
+                    if (piece.len < block_size && read_data(piece.disk, block, 0, block_size, data[i]))
+                        return -1;
+                }
+                memcpy(data[i] + piece.offset, piece.data, piece.len);
+            }
+            return write_stripe(block, data);
+        }
+
+        // Reconstruct-write of a degraded row: P and Q from the complete new row,
+        // the untouched blocks read from the disks in service and rebuilt from
+        // the rest of the row for the failed ones. Nothing is read from a failed
+        // disk; it is written only while a rebuild is filling it.
+        int write_degraded(int block, const vector<char *> &data)
+        {
+            int num_data = data.size();
+            vector<int> row = data_disks(block);
+            int disk_p = get_parity_disk(block, 0);
+            int disk_q = get_parity_disk(block, 1);
+            // one view of the failed disks for the whole row
+            vector<char> lost(num_disks), writable(num_disks);
+            for (int i = 0; i < num_disks; ++i)
+            {
+                lost[i] = failed[i];
+                writable[i] = !lost[i] || rebuilding[i];
+            }
+            ArenaBlocks bufs(*arena);
+            vector<int> clean;
+            for (int i = 0; i < num_data; ++i)
+            {
+                if (!data[i] && !lost[row[i]])
+                    clean.push_back(row[i]);
+            }
+            vector<char *> loaded;
+            if (!load_blocks(block, clean, loaded, bufs))
+                return -1;
+            vector<char *> full;
+            vector<IORequest> batch;
+            int next = 0;
+            for (int i = 0; i < num_data; ++i)
+            {
+                if (data[i])
+                {
+                    full.push_back(data[i]);
+                    if (writable[row[i]])
+                        batch.push_back({row[i], block_offset(block), (size_t)block_size, data[i]});
+                }
+                else if (!lost[row[i]])
+                {
+                    full.push_back(loaded[next++]);
+                }
+                else
+                {
+                    char *buf = bufs.get();
+                    if (reconstruct(row[i], block, buf))
+                        return -1;
+                    full.push_back(buf);
+                }
+            }
+            char *p_block = bufs.get();
+            char *q_block = bufs.get();
+            parity->gen_syndrome(block_size, full, p_block, q_block);
+            if (writable[disk_p])
+                batch.push_back({disk_p, block_offset(block), (size_t)block_size, p_block});
+            if (writable[disk_q])
+                batch.push_back({disk_q, block_offset(block), (size_t)block_size, q_block});
+            return store_batch(batch);
+        }
+
+        string path;
+        Options options;
+        // where the first block of a disk starts, 0 for arrays described by a config file
+        off_t data_offset = SUPERBLOCK_SIZE;
+        // of the superblocks last written
+        uint64_t generation = 0;
+        Parity *parity = nullptr;
+        // member disk access, kept open between init/load and destruction
+        Storage *storage = nullptr;
+        // buffers of stripe operations
+        BlockArena *arena = nullptr;
+        // write-back cache of rows, nullptr when options.cache_stripes is 0
+        StripeCache *cache = nullptr;
+        // guards the cache map, LRU order and dirty state, changed only with the
+        // row's write lock held as well; cached block contents are under the row locks
+        std::mutex cache_mutex;
+        static constexpr int NUM_STRIPE_LOCKS = 1024;
+        StripeLockTable locks{NUM_STRIPE_LOCKS};
+        // the geometry, shared by every public operation and taken alone by
+        // grow() and each window of a reshape
+        std::shared_mutex layout_mutex;
+        // while a reshape runs: the disk count rows from reshape_row on still
+        // have, 0 otherwise
+        int reshape_disks = 0;
+        int reshape_row = 0;
+        // rebuild_disk() calls running, each between its windows takes the
+        // geometry as it was when it started
+        std::atomic<int> rebuilds{0};
+        // member disks missing, unreadable or failed by fail_disk()
+        vector<std::atomic<bool>> failed;
+        // failed disks a rebuild is filling: not read, but written with their row,
+        // so the rows it has passed stay current
+        vector<std::atomic<bool>> rebuilding;
+        // per disk block checksums, empty unless options.checksums
+        vector<ChecksumFile> checksums;
+        // rows with parity updates in flight, nullptr unless options.write_intent
+        WriteIntentBitmap *bitmap = nullptr;
+        // workers of the async calls, nullptr until the first one
+        ThreadPool *executor = nullptr;
+        std::mutex executor_mutex;
+        // idle bitmap regions that trigger a lazy clear
+        static constexpr int INTENT_CLEAR_REGIONS = 64;
+        string get_disk_path(int disk)
+        {
+            return path + "disk" + std::to_string(disk);
+        }
+
+        string get_config_path()
+        {
+            return path + "config";
+        }
+
+        string get_checkpoint_path()
+        {
+            return path + "rebuild";
+        }
+
+        // the stripe a rebuild of the same disks stopped at, 0 without a checkpoint
+        int read_checkpoint(const vector<int> &targets)
+        {
+            fstream checkpoint_file(get_checkpoint_path(), std::ios::in);
+            if (!checkpoint_file.is_open())
+                return 0;
+            int disk = -1, disk2 = -1, next_block = 0;
+            checkpoint_file >> disk >> disk2 >> next_block;
+            int target2 = targets.size() > 1 ? targets[1] : -1;
+            if (!checkpoint_file || disk != targets[0] || disk2 != target2)
+                return 0;
+            return std::min(next_block, num_blocks);
+        }
+
+        // replaced durably, so a crash leaves the old or the new checkpoint
+        int write_checkpoint(const vector<int> &targets, int next_block)
+        {
+            string content = std::to_string(targets[0]) + " " + std::to_string(targets.size() > 1 ? targets[1] : -1) +
+                             " " + std::to_string(next_block) + "\n";
+            if (replace_file(get_checkpoint_path(), content))
+            {
+                cerr << "Error: failed to write checkpoint file" << endl;
+                return -1;
+            }
+            return 0;
+        }
+
+        // the content of a file replaced durably through a rename, a crash
+        // leaves the old or the new one
+        int replace_file(const string &file_path, const string &content)
+        {
+            string tmp_path = file_path + ".tmp";
+            int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+                return -1;
+            bool written = ::write(fd, content.data(), content.size()) == (ssize_t)content.size() && fdatasync(fd) == 0;
+            ::close(fd);
+            if (!written || std::rename(tmp_path.c_str(), file_path.c_str()))
+                return -1;
+            return 0;
+        }
+
+        // arrays from before superblocks, their data starts at 0
+        int read_config()
+        {
+            fstream config_file(get_config_path(), std::ios::in);
             if (!config_file.is_open())
             {
-                cerr << "Error: failed to create config file" << endl;
-                return -1;
+                cerr << "Error: no valid superblock or config file" << endl;
+                return -1;
+            }
+            config_file >> num_disks;
+            config_file >> num_blocks;
+            config_file >> block_size;
+            // arrays from before chunks rotate parity every row
+            if (!(config_file >> chunk_size))
+                chunk_size = block_size;
+            if (!config_file.eof() && config_file.fail())
+            {
+                cerr << "Error: failed to read config file" << endl;
+                return -1;
+            }
+            return 0;
+        }
+
+        int write_config()
+        {
+            string content = std::to_string(num_disks) + "\n" + std::to_string(num_blocks) + "\n" +
+                             std::to_string(block_size) + "\n" + std::to_string(chunk_size) + "\n";
+            if (replace_file(get_config_path(), content))
+            {
+                cerr << "Error: failed to write config file" << endl;
+                return -1;
+            }
+            return 0;
+        }
+
+        // One pread per disk. Copies are read up to the disk count of the newest
+        // so far, disks 0 to 2 at least: with all three missing there is nothing to load.
+        bool read_superblocks(Superblock &newest)
+        {
+            bool found = false;
+            for (int i = 0; i < (found ? (int)newest.num_disks : 3); ++i)
+            {
+                Superblock sb{};
+                if (!sb.read(get_disk_path(i)) || sb.disk != (uint32_t)i)
+                    continue;
+                if (!found || sb.generation > newest.generation)
+                    newest = sb;
+                found = true;
+            }
+            return found;
+        }
+
+        // the copy of one disk, at the current generation
+        int write_superblock(int disk)
+        {
+            Superblock sb{SUPERBLOCK_MAGIC, SUPERBLOCK_VERSION, generation, (uint32_t)num_disks, (uint32_t)num_blocks,
+                          (uint32_t)block_size, (uint32_t)chunk_size, LAYOUT_ROTATING, (uint32_t)disk, 0};
+            sb.seal();
+            vector<char> buf(SUPERBLOCK_SIZE, 0);
+            memcpy(buf.data(), &sb, sizeof(sb));
+            if (storage->write(disk, 0, buf.size(), buf.data()))
+            {
+                cerr << "Error: failed to write superblock of disk " << disk << endl;
+                return -1;
+            }
+            return 0;
+        }
+
+        // the geometry made durable on every disk not failed, under a new generation
+        int write_metadata()
+        {
+            if (!data_offset)
+                return write_config();
+            generation++;
+            for (int i = 0; i < num_disks; ++i)
+            {
+                if (!failed[i] && write_superblock(i))
+                    return -1;
+            }
+            return storage->sync();
+        }
+
+        string get_reshape_path()
+        {
+            return path + "reshape";
+        }
+
+        // A reshape checkpoint: the old disk count, the first row not moved yet,
+        // and for a window saved to the backup file the row it ends at.
+        int write_reshape_checkpoint(int old_disks, int row, int end, bool backup)
+        {
+            string content = std::to_string(old_disks) + " " + std::to_string(row) + " " +
+                             std::to_string(end) + " " + std::to_string(backup) + "\n";
+            if (replace_file(get_reshape_path(), content))
+            {
+                cerr << "Error: failed to write reshape checkpoint" << endl;
+                return -1;
+            }
+            return 0;
+        }
+
+        bool read_reshape_checkpoint(int &old_disks, int &row, int &end, bool &backup)
+        {
+            fstream checkpoint_file(get_reshape_path(), std::ios::in);
+            if (!checkpoint_file.is_open())
+                return false;
+            checkpoint_file >> old_disks >> row >> end >> backup;
+            return (bool)checkpoint_file;
+        }
+
+        void remove_reshape_files()
+        {
+            std::remove(get_reshape_path().c_str());
+            std::remove((get_reshape_path() + ".backup").c_str());
+        }
+
+        // the disks of num_disks opened again, after one was added or taken back
+        int open_members()
+        {
+            vector<string> disk_paths;
+            for (int i = 0; i < num_disks; i++)
+            {
+                disk_paths.push_back(get_disk_path(i));
+            }
+            if (storage->open(disk_paths))
+                return -1;
+            failed = vector<std::atomic<bool>>(num_disks);
+            rebuilding = vector<std::atomic<bool>>(num_disks);
+            for (int i = 0; i < num_disks; i++)
+            {
+                if (!storage->is_open(i))
+                    return -1;
+            }
+            if (options.checksums && open_checksums(false))
+                return -1;
+            return 0;
+        }
+
+        using WindowBuffer = std::unique_ptr<char, decltype(&free)>;
+
+        // the blocks of rows [r0, r1) of the new layout, in volume order
+        WindowBuffer alloc_window(int r0, int r1, size_t &bytes)
+        {
+            bytes = (size_t)(r1 - r0) * (num_disks - 2) * block_size;
+            void *mem = nullptr;
+            if (posix_memalign(&mem, ARENA_ALIGNMENT, bytes))
+                mem = nullptr;
+            return WindowBuffer((char *)mem, free);
+        }
+
+        // One window of a reshape. The blocks rows [r0, r1) take in the new layout
+        // are read from where the old one keeps them, then the rows are written as
+        // full stripes. While the rows still hold blocks of the window itself, the
+        // window goes to a backup first and the checkpoint points at it, so load()
+        // repairs a crash in between; otherwise the old copies survive a crash.
+        int reshape_window(int r0, int r1)
+        {
+            size_t bytes;
+            WindowBuffer window = alloc_window(r0, r1, bytes);
+            if (!window)
+                return -1;
+            memset(window.get(), 0, bytes);
+            size_t first = (size_t)r0 * (num_disks - 2) * block_size;
+            // beyond the old volume the window stays zero
+            size_t old_end = volume_size();
+            if (first < old_end)
+            {
+                vector<Piece> pieces;
+                if (logical_pieces(first, std::min(bytes, old_end - first), window.get(), pieces) || get_pieces(pieces))
+                    return -1;
+            }
+            bool backup = (size_t)r1 * (reshape_disks - 2) * block_size > first;
+            if (backup && (write_reshape_backup(window.get(), bytes) || write_reshape_checkpoint(reshape_disks, r0, r1, true)))
+                return -1;
+            reshape_row = r1;
+            if (write_reshape_rows(r0, r1, window.get()))
+                return -1;
+            return write_reshape_checkpoint(reshape_disks, r1, r1, false);
+        }
+
+        // rows [r0, r1) of the new layout as full stripes, then made durable
+        int write_reshape_rows(int r0, int r1, char *window)
+        {
+            int num_data = num_disks - 2;
+            size_t first = (size_t)r0 * num_data;
+            for (int block = r0; block < r1; ++block)
+            {
+                vector<char *> data(num_data);
+                int stripe = block / chunk_blocks();
+                for (int i = 0; i < num_data; ++i)
+                {
+                    size_t lba = ((size_t)stripe * num_data + i) * chunk_blocks() + block % chunk_blocks();
+                    data[i] = window + (lba - first) * block_size;
+                }
+                if (write_stripe(block, data))
+                    return -1;
+            }
+            for (auto &checksum : checksums)
+            {
+                if (checksum.sync())
+                    return -1;
+            }
+            return storage->sync();
+        }
+
+        int write_reshape_backup(const char *window, size_t bytes)
+        {
+            int fd = ::open((get_reshape_path() + ".backup").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            bool written = fd >= 0 && pwrite_full(fd, window, bytes, 0) == 0 && fdatasync(fd) == 0;
+            if (fd >= 0)
+                ::close(fd);
+            if (!written)
+            {
+                cerr << "Error: failed to write reshape backup" << endl;
+                return -1;
+            }
+            return 0;
+        }
+
+        // write the window a crash interrupted again, from its backup
+        int restore_reshape_window(int r0, int r1)
+        {
+            size_t bytes;
+            WindowBuffer window = alloc_window(r0, r1, bytes);
+            if (!window)
+                return -1;
+            int fd = ::open((get_reshape_path() + ".backup").c_str(), O_RDONLY);
+            bool loaded = fd >= 0 && pread_full(fd, window.get(), bytes, 0) == 0;
+            if (fd >= 0)
+                ::close(fd);
+            if (!loaded)
+            {
+                cerr << "Error: failed to read reshape backup" << endl;
+                return -1;
+            }
+            reshape_row = r1;
+            if (write_reshape_rows(r0, r1, window.get()))
+                return -1;
+            return write_reshape_checkpoint(reshape_disks, r1, r1, false);
+        }
+
+        // every row moved: the volume takes its new size and the cache returns
+        int finish_reshape()
+        {
+            reshape_disks = 0;
+            reshape_row = 0;
+            remove_reshape_files();
+            if (options.cache_stripes > 0)
+                cache = new StripeCache(*arena, num_disks - 2, options.cache_stripes, options.cache_flush_ms);
+            return 0;
+        }
+
+        // a new or replaced disk file, created or extended to the size of the array
+        int prepare_disk(int disk)
+        {
+            int fd = ::open(get_disk_path(disk).c_str(), O_RDWR | O_CREAT, 0644);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st))
+            {
+                cerr << "Error: failed to create disk" << endl;
+                if (fd >= 0)
+                    ::close(fd);
+                return -1;
+            }
+            int status = 0;
+            if (st.st_size < block_offset(num_blocks) && ftruncate(fd, block_offset(num_blocks)))
+            {
+                cerr << "Error: failed to size disk" << endl;
+                status = -1;
+            }
+            else if (options.preallocate && fallocate(fd, 0, 0, block_offset(num_blocks)))
+            {
+                cerr << "Error: failed to preallocate disk" << endl;
+                status = -1;
+            }
+            ::close(fd);
+            return status;
+        }
+
+        int chunk_blocks()
+        {
+            return chunk_size / block_size;
+        }
+
+        // the members of the layout of a row
+        int row_disks(int block)
+        {
+            return reshape_disks && block >= reshape_row ? reshape_disks : num_disks;
+        }
+
+        int get_parity_disk(int block, int policy)
+        {
+            int stripe = block / chunk_blocks();
+            int n = row_disks(block);
+            return ((stripe + 1) * (n - 1) - 1 + policy) % n;
+        }
+
+        bool is_parity_block(int disk, int block)
+        {
+            return get_parity_disk(block, 0) == disk || get_parity_disk(block, 1) == disk;
+        }
+
+        // P and Q of a stripe of n disks sit on neighbouring disks, P first (mod n),
+        // and on one disk P falls in stripe (n - disk - 2) mod n of every n
+        // stripes, Q in the stripe after. Both the data disks of a row and the
+        // data chunks of a disk are therefore 0..n-1 with a pair first, first + 1
+        // (mod n) left out.
+
+        // the i-th of the n - 2 members left when the pair at first is left out
+        int skip_pair(int i, int first, int n)
+        {
+            if (first == n - 1)
+                return i + 1;
+            return i < first ? i : i + 2;
+        }
+
+        // inverse of skip_pair
+        int rank_skipping_pair(int member, int first, int n)
+        {
+            if (first == n - 1)
+                return member - 1;
+            return member < first ? member : member - 2;
+        }
+
+        // position of a data disk among the data blocks of its row
+        int data_index(int disk, int block)
+        {
+            return rank_skipping_pair(disk, get_parity_disk(block, 0), row_disks(block));
+        }
+
+        // the disk holding a data index of a row
+        int data_disk(int block, int index)
+        {
+            return skip_pair(index, get_parity_disk(block, 0), row_disks(block));
+        }
+
+        // per disk positions count the data blocks of the disk only
+        void data_position_to_block_offset(int disk, size_t position, int &block, int &offset)
+        {
+            offset = position % block_size;
+            size_t num_data_block = position / block_size;
+            size_t num_data_chunk = num_data_block / chunk_blocks();
+            int p_stripe = (2 * num_disks - disk - 2) % num_disks;
+            int stripe = num_data_chunk / (num_disks - 2) * num_disks + skip_pair(num_data_chunk % (num_disks - 2), p_stripe, num_disks);
+            block = stripe * chunk_blocks() + num_data_block % chunk_blocks();
+        }
+
+        // in the layout of num_disks, the one a reshape moves to
+        size_t disk_data_size(int disk)
+        {
+            int num_stripes = num_blocks / chunk_blocks();
+            int data_chunks = num_stripes / num_disks * (num_disks - 2);
+            int p_stripe = (2 * num_disks - disk - 2) % num_disks;
+            for (int stripe = num_stripes / num_disks * num_disks; stripe < num_stripes; ++stripe)
+            {
+                int k = stripe % num_disks;
+                if (k != p_stripe && k != (p_stripe + 1) % num_disks)
+                    data_chunks++;
+            }
+            return (size_t)data_chunks * chunk_size;
+        }
+
+        size_t volume_size()
+        {
+            int n = reshape_disks ? reshape_disks : num_disks;
+            return (size_t)num_blocks * (n - 2) * block_size;
+        }
+
+        int check_disk_range(int disk, size_t position, size_t data_len)
+        {
+            // the data rows of a disk change with the layout
+            if (reshape_disks)
+            {
+                cerr << "Error: per disk positions move during a reshape, use the logical volume" << endl;
+                return -1;
+            }
+            if (disk < 0 || disk >= num_disks || position + data_len > disk_data_size(disk))
+            {
+                cerr << "Error: range beyond the data of disk " << disk << endl;
+                return -1;
+            }
+            return 0;
+        }
+
+        // the data block of a disk after block, past the P and Q rows
+        int next_data_block(int disk, int block)
+        {
+            do
+            {
+                block++;
+            } while (is_parity_block(disk, block));
+            return block;
+        }
+
+        // A new array directory in place of any old one. The disk files are sized
+        // without writing: their holes read as zeros, and zero data has zero P and Q,
+        // so a new array is consistent at any capacity.
+        int create_folders(string path, int num_disks)
+        {
+            std::error_code error;
+            std::filesystem::remove_all(path, error);
+            if (!error)
+                std::filesystem::create_directories(path, error);
+            if (error)
+            {
+                cerr << "Error: failed to create directory " << path << endl;
+                return -1;
+            }
+
+            // Create file for each disk
+            for (int i = 0; i < num_disks; i++)
+            {
+                if (prepare_disk(i))
+                    return -1;
+            }
+            return 0;
+        }
+
+        int write(int disk, int block, int offset, int data_len, const char *data, bool checksum = true)
+        {
+            if (offset + data_len > block_size)
+            {
+                cerr << "Error: offset + data_len is greater than block_size" << endl;
+                cerr << "offset: " << offset << " data_len: " << data_len << " block_size: " << block_size << endl;
+                return -1;
+            }
+            if (storage->write(disk, block_offset(block) + offset, data_len, data))
+                return -1;
+            if (!checksum || checksums.empty())
+                return 0;
+            return data_len == block_size ? update_checksum(disk, block, data) : refresh_checksum(disk, block);
+        }
+        int read(int disk, int block, int offset, int data_len, char *data)
+        {
+            if (offset + data_len > block_size)
+            {
+                cerr << "Error: offset + data_len is greater than block_size" << endl;
+                cerr << "offset: " << offset << " data_len: " << data_len << " block_size: " << block_size << endl;
+                return -1;
+            }
+            return storage->read(disk, block_offset(block) + offset, data_len, data);
+        }
+
+        off_t block_offset(int block)
+        {
+            return data_offset + (off_t)block * block_size;
+        }
+
+        // Fill the buffers of a batch of reads, issued together.
+        // Requests served by mapped pages get buf pointed at the mapping instead,
+        // so callers use req.buf afterwards.
+        int load_batch(vector<IORequest> &batch)
+        {
+            vector<IORequest> reads;
+            reads.reserve(batch.size());
+            for (auto &req : batch)
+            {
+                char *mapped = storage->map(req.disk, req.pos);
+                if (mapped)
+                    req.buf = mapped;
+                else
+                    reads.push_back(req);
+            }
+            return storage->submit(reads);
+        }
+
+        // Write a batch back, issued together. Buffers that are the mapped
+        // pages themselves were changed in place and are only committed.
+        int store_batch(vector<IORequest> &batch)
+        {
+            vector<IORequest> writes;
+            for (auto &req : batch)
+            {
+                if (req.buf == storage->map(req.disk, req.pos))
+                {
+                    if (storage->commit(req.disk, req.pos, req.len))
+                        return -1;
+                    continue;
+                }
+                writes.push_back(req);
+                writes.back().write = true;
+            }
+            if (storage->submit(writes))
+                return -1;
+            if (checksums.empty())
+                return 0;
+            for (auto &req : batch)
+            {
+                int block = (req.pos - data_offset) / block_size;
+                bool whole = req.pos == block_offset(block) && req.len == (size_t)block_size;
+                if (whole ? update_checksum(req.disk, block, req.buf) : refresh_checksum(req.disk, block))
+                    return -1;
+            }
+            return 0;
+        }
+
+        // whole blocks of a row from the listed disks, in order and in one batch;
+        // buffers they need are taken from bufs
+        bool load_blocks(int block, const vector<int> &disks, vector<char *> &blocks, ArenaBlocks &bufs)
+        {
+            vector<IORequest> batch;
+            for (int disk : disks)
+            {
+                char *buf = nullptr;
+                if (!storage->map(disk, block_offset(block)))
+                    buf = bufs.get();
+                batch.push_back({disk, block_offset(block), (size_t)block_size, buf});
+            }
+            if (load_batch(batch))
+                return false;
+            for (auto &req : batch)
+            {
+                blocks.push_back(req.buf);
+            }
+            return true;
+        }
+
+        // data disks of a row in data index order
+        vector<int> data_disks(int block)
+        {
+            vector<int> disks;
+            for (int i = 0; i < row_disks(block) - 2; ++i)
+            {
+                disks.push_back(data_disk(block, i));
+            }
+            return disks;
+        }
+
+        // zeroed: the disk files were just created and hold only zeros
+        int open_disks(bool zeroed = false)
+        {
+            if (options.direct_io && options.backend != BACKEND_FILE)
+            {
+                cerr << "Error: direct I/O needs the file backend" << endl;
+                return -1;
+            }
+            vector<string> disk_paths;
+            for (int i = 0; i < num_disks; i++)
+            {
+                disk_paths.push_back(get_disk_path(i));
+            }
+            delete storage;
+            storage = make_storage(options);
+            if (storage->open(disk_paths))
+                return -1;
+            failed = vector<std::atomic<bool>>(num_disks);
+            rebuilding = vector<std::atomic<bool>>(num_disks);
+            int num_failed = 0;
+            for (int i = 0; i < num_disks; i++)
+            {
+                if (!storage->is_open(i))
+                {
+                    failed[i] = true;
+                    num_failed++;
+                }
+            }
+            if (num_failed > 2)
+            {
+                cerr << "Error: more than two disks missing" << endl;
+                return -1;
+            }
+            if (block_size % storage->alignment() || data_offset % storage->alignment())
+            {
+                cerr << "Error: block_size must be a multiple of " << storage->alignment() << " for direct I/O" << endl;
+                return -1;
+            }
+            delete cache;
+            cache = nullptr;
+            delete arena;
+            arena = new BlockArena(block_size);
+            // set aside while a reshape runs, see add_disk()
+            if (options.cache_stripes > 0 && !reshape_disks)
+                cache = new StripeCache(*arena, num_disks - 2, options.cache_stripes, options.cache_flush_ms);
+            checksums = vector<ChecksumFile>();
+            if (options.checksums && open_checksums(zeroed))
+                return -1;
+            delete bitmap;
+            bitmap = nullptr;
+            if (options.write_intent)
+            {
+                bitmap = new WriteIntentBitmap();
+                if (bitmap->open(path + "bitmap", num_blocks, options.intent_region_blocks) || resync())
+                    return -1;
+            }
+            return 0;
+        }
+
+        // make the disks durable, then clear the bitmap regions idle before that
+        int clear_intent()
+        {
+            auto idle = bitmap->begin_clear();
+            if (storage->sync())
+                return -1;
+            return bitmap->end_clear(idle);
+        }
+
+        // bits are cleared in groups, each clear costs a sync of every disk
+        int settle_intent()
+        {
+            if (bitmap && bitmap->idle_regions() >= INTENT_CLEAR_REGIONS)
+                return clear_intent();
+            return 0;
+        }
+
+        // Recompute the parity of the rows in regions left set by a crash, taking
+        // their data as it is. Needs every disk, the bits stay set otherwise.
+        int resync()
+        {
+            vector<int> regions = bitmap->dirty_regions();
+            if (regions.empty())
+                return 0;
+            if (std::find(failed.begin(), failed.end(), true) != failed.end())
+            {
+                cerr << "Error: can not resync the write-intent bitmap with a failed disk" << endl;
+                return 0;
+            }
+            int region_blocks = bitmap->get_region_blocks();
+            for (int region : regions)
+            {
+                int end = std::min(num_blocks, (region + 1) * region_blocks);
+                for (int block = region * region_blocks; block < end; ++block)
+                {
+                    if (resync_row(block))
+                        return -1;
+                }
+            }
+            return clear_intent();
+        }
+
+        int resync_row(int block)
+        {
+            vector<int> disks = data_disks(block);
+            vector<char *> data;
+            ArenaBlocks bufs(*arena);
+            if (!load_blocks(block, disks, data, bufs))
+                return -1;
+            // a data write may have landed without its checksum
+            for (int k = 0; k < (int)disks.size() && !checksums.empty(); ++k)
+            {
+                if (update_checksum(disks[k], block, data[k]))
+                    return -1;
+            }
+            vector<IORequest> batch = {
+                {get_parity_disk(block, 0), block_offset(block), (size_t)block_size, bufs.get()},
+                {get_parity_disk(block, 1), block_offset(block), (size_t)block_size, bufs.get()},
+            };
+            parity->gen_syndrome(block_size, data, batch[0].buf, batch[1].buf);
+            return store_batch(batch);
+        }
+
+        // the sidecar checksums, computed from the disks when missing or stale
+        int open_checksums(bool zeroed)
+        {
+            checksums = vector<ChecksumFile>(num_disks);
+            ArenaBlocks bufs(*arena);
+            uint32_t zero_crc = crc32c(bufs.get_zeroed(), block_size);
+            // the blocks of a disk are read a window at a time into the same buffers
+            vector<char *> window(std::min(num_blocks, BATCH_WINDOW_ROWS));
+            for (auto &buf : window)
+            {
+                buf = bufs.get();
+            }
+            for (int i = 0; i < num_disks; i++)
+            {
+                bool valid;
+                if (checksums[i].open(get_disk_path(i) + ".crc", num_blocks, valid))
+                    return -1;
+                // a failed disk gets its checksums from rebuild_disk
+                if (valid || failed[i])
+                    continue;
+                vector<uint32_t> values(num_blocks, zero_crc);
+                for (int first = 0; first < num_blocks && !zeroed; first += window.size())
+                {
+                    int end = std::min(num_blocks, first + (int)window.size());
+                    vector<IORequest> batch;
+                    for (int block = first; block < end; ++block)
+                    {
+                        batch.push_back({i, block_offset(block), (size_t)block_size, window[block - first]});
+                    }
+                    if (load_batch(batch))
+                        return -1;
+                    for (int block = first; block < end; ++block)
+                    {
+                        values[block] = crc32c(batch[block - first].buf, block_size);
+                    }
+                }
+                if (checksums[i].assign(values))
+                    return -1;
+            }
+            return 0;
+        }
+
+        int update_checksum(int disk, int block, const char *block_data)
+        {
+            return checksums[disk].set(block, crc32c(block_data, block_size), options.sync);
+        }
+
+        // the checksum of a block from its content on disk, after a partial write
+        int refresh_checksum(int disk, int block)
+        {
+            ArenaBlocks bufs(*arena);
+            vector<IORequest> batch = {{disk, block_offset(block), (size_t)block_size, bufs.get()}};
+            if (load_batch(batch))
+                return -1;
+            return update_checksum(disk, block, batch[0].buf);
+        }
+
+        bool verify_checksum(int disk, int block, const char *block_data)
+        {
+            return checksums.empty() || crc32c(block_data, block_size) == checksums[disk].get(block);
+        }
+
+        // Rebuild a block that failed its checksum from the rest of the row, in
+        // memory. A data block is tried from P and then from Q, the candidate that
+        // matches the stored checksum is taken.
+        int recover_block(int disk, int block, char *out)
+        {
+            if (reconstruct(disk, block, out) == 0 && verify_checksum(disk, block, out))
+                return 0;
+            bool none_failed = std::find(failed.begin(), failed.end(), true) == failed.end();
+            if (none_failed && !is_parity_block(disk, block) && decode_single_q(disk, block, out) == 0 &&
+                verify_checksum(disk, block, out))
+                return 0;
+            cerr << "Error: block " << block << " of disk " << disk << " failed its checksum and can not be repaired" << endl;
+            return -1;
+        }
+
+        // recover_block and write the block back, under the row's write lock
+        int repair_block(int disk, int block, char *out)
+        {
+            if (recover_block(disk, block, out))
+                return -1;
+            return write(disk, block, 0, block_size, out);
+        }
+
+        // The write-back of blocks a reader found corrupt, each under its row's
+        // write lock. A block a writer or another reader rewrote meanwhile passes
+        // its checksum again and is left alone.
+        int repair_blocks(const vector<std::pair<int, int>> &repairs)
+        {
+            for (auto &repair : repairs)
+            {
+                int disk = repair.first, block = repair.second;
+                WriteLock row_lock(locks.get(block));
+                if (failed[disk])
+                    continue;
+                ArenaBlocks bufs(*arena);
+                vector<char *> loaded;
+                if (!load_blocks(block, {disk}, loaded, bufs))
+                {
+                    failed[disk] = true;
+                    continue;
+                }
+                if (!verify_checksum(disk, block, loaded[0]) && repair_block(disk, block, bufs.get()))
+                    return -1;
+            }
+            return 0;
+        }
+
+        // Merge a write into the cached row, under the row's write lock. A block
+        // only partly written that is not cached yet is read first, the parity is
+        // left to write_back and eviction to trim_cache.
+        int cache_write(int block, int index, int offset, int len, const char *data)
+        {
+            CachedStripe *stripe;
+            {
+                std::lock_guard<std::mutex> lock(cache_mutex);
+                stripe = cache->find(block);
+                if (!stripe)
+                    stripe = cache->insert(block);
+            }
+            bool fill = !stripe->data[index] && len < block_size;
+            char *buf = cache->buffer(stripe, index);
+            if (fill && read_data(data_disks(block)[index], block, 0, block_size, buf))
+            {
+                std::lock_guard<std::mutex> lock(cache_mutex);
+                cache->drop(stripe, index);
+                return -1;
+            }
+            memcpy(buf + offset, data, len);
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            cache->mark_dirty(stripe, index);
+            return 0;
+        }
+
+        // Evict the rows beyond the capacity and write back the expired ones,
+        // each under its row lock. Called with no row lock held.
+        int flush_cache()
+        {
+            if (!cache)
+                return 0;
+            vector<int> blocks;
+            {
+                std::lock_guard<std::mutex> lock(cache_mutex);
+                blocks = cache->dirty_blocks();
             }
-
-            // Create file for each disk
-            for (int i = 0; i < num_disks; i++)
+            for (int block : blocks)
             {
-                string disk_path = get_disk_path(i);
-                fstream file(disk_path, std::ios::out | std::ios::binary);
-                if (!file.is_open())
-                {
-                    cerr << "Error: failed to create disk" << endl;
+                if (write_back_row(block, false))
                     return -1;
-                }
-                // write num_blocks of zeros
-                char zeros[block_size];
-                memset(zeros, 0, block_size);
-                for (int j = 0; j < num_blocks; j++)
-                {
-                    file.write(zeros, block_size);
-                }
-                file.close();
             }
             return 0;
         }
 
-        int write(int disk, int block, int offset, int data_len, char *data)
+        int trim_cache()
         {
-            if (offset + data_len > block_size)
+            while (true)
             {
-                cerr << "Error: offset + data_len is greater than block_size" << endl;
-                cerr << "offset: " << offset << " data_len: " << data_len << " block_size: " << block_size << endl;
-                return -1;
+                int victim;
+                {
+                    std::lock_guard<std::mutex> lock(cache_mutex);
+                    if (!cache->over_capacity())
+                        break;
+                    victim = cache->victim();
+                }
+                if (write_back_row(victim, true))
+                    return -1;
             }
-            // TODO: avoid frequent open and close
-            fstream file(get_disk_path(disk), std::ios::in | std::ios::out | std::ios::binary);
-            if (!file.is_open())
+            vector<int> expired;
             {
-                cerr << "Error: failed to open disk" << endl;
-                return -1;
+                std::lock_guard<std::mutex> lock(cache_mutex);
+                expired = cache->expired_blocks();
+            }
+            for (int block : expired)
+            {
+                if (write_back_row(block, false))
+                    return -1;
             }
-            file.seekp(block * block_size + offset);
-            file.write(data, data_len);
-            file.close();
             return 0;
         }
-        int read(int disk, int block, int offset, int data_len, char *data)
+
+        // write back one cached row and, if evict is set, drop it from the cache
+        int write_back_row(int block, bool evict)
         {
-            if (offset + data_len > block_size)
+            WriteLock row_lock(locks.get(block));
+            CachedStripe *stripe;
             {
-                cerr << "Error: offset + data_len is greater than block_size" << endl;
-                cerr << "offset: " << offset << " data_len: " << data_len << " block_size: " << block_size << endl;
+                std::lock_guard<std::mutex> lock(cache_mutex);
+                stripe = cache->peek(block);
+            }
+            // evicted by another thread meanwhile
+            if (!stripe)
+                return 0;
+            if (write_back(stripe))
                 return -1;
+            if (evict)
+            {
+                std::lock_guard<std::mutex> lock(cache_mutex);
+                cache->erase(block);
             }
+            return 0;
+        }
 
-            fstream file(get_disk_path(disk), std::ios::in | std::ios::out | std::ios::binary);
-            if (!file.is_open())
+        // Write the changed blocks of a cached row and its parity. A row cached
+        // completely is written as a full stripe, without reading anything.
+        int write_back(CachedStripe *stripe)
+        {
+            if (stripe->num_dirty == 0)
+                return 0;
+            bool complete = true;
+            for (char *buf : stripe->data)
+            {
+                if (!buf)
+                    complete = false;
+            }
+            vector<char *> data(num_disks - 2, nullptr);
+            for (int i = 0; i < num_disks - 2; ++i)
             {
-                cerr << "Error: failed to open disk" << endl;
+                if (complete || stripe->dirty[i])
+                    data[i] = stripe->data[i];
+            }
+            if (write_stripe(stripe->block, data))
                 return -1;
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            for (int i = 0; i < num_disks - 2; ++i)
+            {
+                cache->mark_clean(stripe, i);
             }
-            file.seekg(block * block_size + offset);
-            file.read(data, data_len);
-            file.close();
             return 0;
         }
 
-        int cal_parity(int block, int policy, char *parity_block)
+        // to be tested
+        int recover_case(const vector<std::pair<int, int>> &block_list, int case_num)
         {
-            vector<char *> data;
-            for (int i = 0; i < num_disks; ++i)
+            if (block_list.empty())
+            {
+                cerr << "Error: no block missing" << endl;
+                return -1;
+            }
+            // every case works on one row
+            WriteLock row_lock(locks.get(block_list[0].second));
+            if (case_num == 1)
+            {
+                // 1. one data block is missing
+                // recover from P
+                auto disk = block_list[0].first;
+                auto block = block_list[0].second;
+                rebuild_single_p(disk, block);
+            }
+            else if (case_num == 2)
+            {
+                // 2. one parity block is missing
+                // just recalculate the parity
+                auto disk = block_list[0].first;
+                auto block = block_list[0].second;
+                ArenaBlocks bufs(*arena);
+                char *parity_blocks[2] = {bufs.get(), bufs.get()};
+                cal_parity(block, parity_blocks[0], parity_blocks[1]);
+                int policy = get_parity_disk(block, 0) == disk ? 0 : 1;
+                write(disk, block, 0, block_size, parity_blocks[policy]);
+            }
+            else if (case_num == 3)
+            {
+                // 3. two data blocks are missing
+                assert(block_list.size() == 2);
+                assert(block_list[0].second == block_list[1].second);
+                rebuild_double(block_list[0].first, block_list[1].first, block_list[0].second);
+            }
+            else if (case_num == 4)
             {
-                if (!is_parity_block(i, block))
+                // 4. two parity blocks are missing
+                // assert(block_list.size()==2);
+                auto block = block_list[0].second;
+                ArenaBlocks bufs(*arena);
+                char *parity_blocks[2] = {bufs.get(), bufs.get()};
+                cal_parity(block, parity_blocks[0], parity_blocks[1]);
+                for (int i = 0; i < 2; i++)
                 {
-                    char *data_block = new char[block_size];
-                    if (read(i, block, 0, block_size, data_block))
-                        return -1;
-                    data.push_back(data_block);
+                    write(get_parity_disk(block, i), block, 0, block_size, parity_blocks[i]);
                 }
             }
-            parity->calculate_parity(policies[policy], block_size, data, parity_block);
-            for (int i = 0; i < data.size(); ++i)
+            else if (case_num == 5)
             {
-                delete[] data[i];
+                // 5. one data block and one parity block are missing
+                assert(block_list.size() == 2);
+                assert(block_list[0].second == block_list[1].second);
+                assert(is_parity_block(block_list[1].first, block_list[1].second));
+                // determine the policy of the missing parity block
+                int policy = 0;
+                if (get_parity_disk(block_list[0].second, 0) != block_list[1].first)
+                    policy = 1;
+
+                ArenaBlocks bufs(*arena);
+                char *policy_block = bufs.get();
+                if (policy == 0)
+                {
+                    rebuild_single_q(block_list[0].first, block_list[0].second);
+                    cal_parity(block_list[1].second, 0, policy_block);
+                }
+                else
+                {
+                    rebuild_single_p(block_list[0].first, block_list[0].second);
+                    cal_parity(block_list[1].second, 1, policy_block);
+                }
+                write(block_list[1].first, block_list[1].second, 0, block_size, policy_block);
             }
             return 0;
         }
 
+        int cal_parity(int block, int policy, char *parity_block)
+        {
+            vector<char *> data;
+            ArenaBlocks bufs(*arena);
+            if (!load_blocks(block, data_disks(block), data, bufs))
+                return -1;
+            if (policy == PolicyXOR::index)
+                parity->calculate<PolicyXOR>(block_size, data, parity_block);
+            else
+                parity->calculate<PolicyRS>(block_size, data, parity_block);
+            return 0;
+        }
+
+        // calculate both parities of a row in one pass
+        int cal_parity(int block, char *p_block, char *q_block)
+        {
+            vector<char *> data;
+            ArenaBlocks bufs(*arena);
+            if (!load_blocks(block, data_disks(block), data, bufs))
+                return -1;
+            parity->gen_syndrome(block_size, data, p_block, q_block);
+            return 0;
+        }
+
         int rebuild_double(int disk_x, int disk_y, int block)
+        {
+            ArenaBlocks bufs(*arena);
+            char *data_x = bufs.get(), *data_y = bufs.get();
+            if (decode_double(disk_x, disk_y, block, data_x, data_y))
+                return -1;
+            if (write(disk_x, block, 0, block_size, data_x) || write(disk_y, block, 0, block_size, data_y))
+                return -1;
+            return 0;
+        }
+
+        // two data blocks of a row from the other data blocks and P/Q, in memory
+        int decode_double(int disk_x, int disk_y, int block, char *data_x, char *data_y)
         {
             // disk idx to data idx
             int idx_x = 0, idx_y = 0;
-            vector<char *> data;
-            for (int i = 0; i < num_disks; ++i)
+            int idx_p = get_parity_disk(block, 0);
+            int idx_q = get_parity_disk(block, 1);
+            // the surviving data blocks and both parities in one batch
+            vector<int> disks;
+            for (int i : data_disks(block))
             {
-                if (is_parity_block(i, block))
-                    continue;
                 if (i < disk_x)
                     idx_x++;
                 if (i < disk_y)
                     idx_y++;
-                char *data_block = new char[block_size];
-                if (i == disk_x || i == disk_y)
-                {
-                    memset(data_block, 0, block_size);
-                }
-                else
-                {
-                    if (read(i, block, 0, block_size, data_block))
-                        return -1;
-                }
-                data.push_back(data_block);
+                if (i != disk_x && i != disk_y)
+                    disks.push_back(i);
             }
-            int idx_p = get_parity_disk(block, 0);
-            int idx_q = get_parity_disk(block, 1);
+            disks.push_back(idx_p);
+            disks.push_back(idx_q);
+            vector<char *> loaded;
+            ArenaBlocks bufs(*arena);
+            if (!load_blocks(block, disks, loaded, bufs))
+                return -1;
+            char *parity_p = loaded[loaded.size() - 2];
+            char *parity_q = loaded[loaded.size() - 1];
+
+            // the missing blocks count as zero
+            char *zeros = bufs.get_zeroed();
+            vector<char *> data;
+            int next = 0;
+            for (int i : data_disks(block))
+            {
+                data.push_back(i == disk_x || i == disk_y ? zeros : loaded[next++]);
+            }
+
+            parity->decode_data_pair(block_size, data, idx_x, idx_y, parity_p, parity_q, data_x, data_y);
+            return 0;
+        }
 
-            // g^(y-x)
-            int coef_yx = parity->gf_pow_02(idx_y - idx_x);
-            // g^(-x)
-            int coef_x = parity->gf_pow_02(-idx_x);
-            // g^(y-x)+01
-            int coef_yx_01 = coef_yx ^ 0x01;
-            // (g^(y-x)+01)^-1
-            int coef_yx_01_inv = parity->gf_inverse(coef_yx_01);
+        // rebuild data from parity P
+        int rebuild_single_p(int disk, int block)
+        {
+            ArenaBlocks bufs(*arena);
+            char *new_data = bufs.get();
+            if (decode_single_p(disk, block, new_data))
+                return -1;
+            return write(disk, block, 0, block_size, new_data);
+        }
 
-            int A = parity->gf_multiply(coef_yx_01_inv, coef_yx);
-            int B = parity->gf_multiply(coef_yx_01_inv, coef_x);
-            char data_x[block_size], data_y[block_size];
+        int decode_single_p(int disk, int block, char *new_data)
+        {
+            int disk_p = get_parity_disk(block, 0);
+            // data other than the broken one
+            vector<int> disks;
+            for (int i : data_disks(block))
+            {
+                if (i != disk)
+                    disks.push_back(i);
+            }
+            disks.push_back(disk_p);
+            vector<char *> data;
+            ArenaBlocks bufs(*arena);
+            if (!load_blocks(block, disks, data, bufs))
+                return -1;
 
-            char parity_p[block_size], parity_q[block_size];
-            read(idx_p, block, 0, block_size, parity_p);
-            read(idx_q, block, 0, block_size, parity_q);
+            parity->calculate<PolicyXOR>(block_size, data, new_data);
+            return 0;
+        }
 
-            char parity_p_xy[block_size], parity_q_xy[block_size];
-            parity->calculate_parity(policies[0], block_size, data, parity_p_xy);
-            parity->calculate_parity(policies[1], block_size, data, parity_q_xy);
+        // rebuild data from parity Q
+        int rebuild_single_q(int disk, int block)
+        {
+            ArenaBlocks bufs(*arena);
+            char *new_data = bufs.get();
+            if (decode_single_q(disk, block, new_data))
+                return -1;
+            return write(disk, block, 0, block_size, new_data);
+        }
 
-            // D_x = A*(P+P_xy)+B*(Q+Q_xy)
-            char middle1[block_size], middle2[block_size];
-            parity->XOR_block(parity_p, parity_p_xy, block_size, middle1);
-            parity->XOR_block(parity_q, parity_q_xy, block_size, middle2);
-            parity->gf_multiply_byte_block(middle1, A, block_size, middle1);
-            parity->gf_multiply_byte_block(middle2, B, block_size, middle2);
-            parity->XOR_block(middle1, middle2, block_size, data_x);
+        int decode_single_q(int disk, int block, char *new_parity)
+        {
+            int disk_q = get_parity_disk(block, 1);
+            // the surviving data blocks and Q in one batch
+            vector<int> disks;
+            int idx_x = 0;
+            vector<int> row = data_disks(block);
+            for (int idx = 0; idx < (int)row.size(); ++idx)
+            {
+                if (row[idx] == disk)
+                    idx_x = idx;
+                else
+                    disks.push_back(row[idx]);
+            }
+            disks.push_back(disk_q);
+            vector<char *> loaded;
+            ArenaBlocks bufs(*arena);
+            if (!load_blocks(block, disks, loaded, bufs))
+                return -1;
+            char *parity_block = loaded.back();
 
-            // D_y = (P+P_xy)+D_x
-            parity->XOR_block(parity_p, parity_p_xy, block_size, middle1);
-            parity->XOR_block(middle1, data_x, block_size, data_y);
+            // the missing block counts as zero
+            char *zeros = bufs.get_zeroed();
+            vector<char *> data;
+            int next = 0;
+            for (int i : row)
+            {
+                data.push_back(i == disk ? zeros : loaded[next++]);
+            }
 
-            write(disk_x, block, 0, block_size, data_x);
-            write(disk_y, block, 0, block_size, data_y);
+            parity->decode_data_q(block_size, data, idx_x, parity_block, new_parity);
+            return 0;
+        }
 
-            for (int i = 0; i < data.size(); ++i)
+        // Read part of a block, rebuilt in memory from the rest of the row when
+        // its disk has failed. A disk that fails to read is marked failed.
+        // With checksums the whole block is read and verified, and repaired on a
+        // mismatch: written back at once under the row's write lock, or added to
+        // repairs when the caller holds only the shared one.
+        int read_data(int disk, int block, int offset, int data_len, char *data,
+                      vector<std::pair<int, int>> *repairs = nullptr)
+        {
+            ArenaBlocks bufs(*arena);
+            if (!failed[disk] && checksums.empty())
+            {
+                if (read(disk, block, offset, data_len, data) == 0)
+                    return 0;
+                failed[disk] = true;
+            }
+            else if (!failed[disk])
             {
-                delete[] data[i];
+                vector<char *> loaded;
+                if (load_blocks(block, {disk}, loaded, bufs))
+                {
+                    char *buf = loaded[0];
+                    if (!verify_checksum(disk, block, buf))
+                    {
+                        buf = bufs.get();
+                        if (repairs ? recover_block(disk, block, buf) : repair_block(disk, block, buf))
+                            return -1;
+                        if (repairs)
+                            repairs->push_back({disk, block});
+                    }
+                    memcpy(data, buf + offset, data_len);
+                    return 0;
+                }
+                failed[disk] = true;
             }
+            char *buf = bufs.get();
+            if (reconstruct(disk, block, buf))
+                return -1;
+            memcpy(data, buf + offset, data_len);
             return 0;
         }
 
-        // rebuild data from parity P
-        int rebuild_single_p(int disk, int block)
+        // one block of a row from the members still in service, nothing is written
+        int reconstruct(int disk, int block, char *out)
         {
             int disk_p = get_parity_disk(block, 0);
-            // data other than the broken one
-            vector<char *> data;
-            for (int i = 0; i < num_disks; ++i)
+            int disk_q = get_parity_disk(block, 1);
+            vector<int> row = data_disks(block);
+            int lost_data = -1, num_lost = 0;
+            for (int i : row)
             {
-                if (i != disk && !is_parity_block(i, block))
+                if (i != disk && failed[i])
                 {
-                    char *data_block = new char[block_size];
-                    if (read(i, block, 0, block_size, data_block))
-                        return -1;
-                    data.push_back(data_block);
+                    lost_data = i;
+                    num_lost++;
+                }
+            }
+            bool lost_p = disk != disk_p && failed[disk_p];
+            bool lost_q = disk != disk_q && failed[disk_q];
+            if (num_lost + lost_p + lost_q > 1)
+            {
+                cerr << "Error: more than two failed disks in stripe " << block << endl;
+                return -1;
+            }
+
+            if (!is_parity_block(disk, block))
+            {
+                if (lost_data >= 0)
+                {
+                    ArenaBlocks bufs(*arena);
+                    return decode_double(disk, lost_data, block, out, bufs.get());
                 }
+                if (lost_p)
+                    return decode_single_q(disk, block, out);
+                return decode_single_p(disk, block, out);
             }
-            char *parity_block = new char[block_size];
-            if (read(disk_p, block, 0, block_size, parity_block))
+
+            int policy = disk == disk_p ? 0 : 1;
+            if (lost_data < 0)
+                return cal_parity(block, policy, out);
+            // the lost data block first, from the parity still there
+            ArenaBlocks bufs(*arena);
+            char *lost = bufs.get();
+            if ((policy == 0 ? decode_single_q(lost_data, block, lost) : decode_single_p(lost_data, block, lost)))
                 return -1;
-            data.push_back(parity_block);
+            return cal_parity_with(block, policy, lost_data, lost, out);
+        }
 
-            char new_data[block_size];
-            parity->calculate_parity(policies[0], block_size, data, new_data);
-            for (int i = 0; i < data.size(); ++i)
+        // one parity of a row, with the block of disk taken from data_block instead
+        int cal_parity_with(int block, int policy, int disk, char *data_block, char *parity_block)
+        {
+            vector<int> row = data_disks(block);
+            vector<int> disks;
+            for (int i : row)
             {
-                delete[] data[i];
+                if (i != disk)
+                    disks.push_back(i);
             }
-            if (write(disk, block, 0, block_size, new_data))
+            vector<char *> loaded;
+            ArenaBlocks bufs(*arena);
+            if (!load_blocks(block, disks, loaded, bufs))
                 return -1;
+            vector<char *> data;
+            int next = 0;
+            for (int i : row)
+            {
+                data.push_back(i == disk ? data_block : loaded[next++]);
+            }
+            if (policy == PolicyXOR::index)
+                parity->calculate<PolicyXOR>(block_size, data, parity_block);
+            else
+                parity->calculate<PolicyRS>(block_size, data, parity_block);
             return 0;
         }
-        int rebuild_single_q(int disk, int block)
+
+        // Verify one row, what is wrong with it goes to errors. A bad block is
+        // named by its checksum, or located from the syndromes without checksums,
+        // and rewritten if repair is set.
+        int scrub_row(int block, bool repair, vector<ScrubError> &errors)
         {
+            int disk_p = get_parity_disk(block, 0);
             int disk_q = get_parity_disk(block, 1);
+            vector<int> disks = data_disks(block);
+            int num_data = disks.size();
+            disks.push_back(disk_p);
+            disks.push_back(disk_q);
             vector<char *> data;
-            int coef_idx = 0, coef_pow = 0;
-            for (int i = 0; i < num_disks; ++i)
+            ArenaBlocks bufs(*arena);
+            if (!load_blocks(block, disks, data, bufs))
+                return -1;
+            char *p_block = data[num_data], *q_block = data[num_data + 1];
+            data.resize(num_data);
+
+            // dp = P + P', dq = Q + Q'
+            char *dp = bufs.get(), *dq = bufs.get();
+            parity->gen_syndrome(block_size, data, dp, dq);
+            parity->XOR_block(dp, p_block, block_size, dp);
+            parity->XOR_block(dq, q_block, block_size, dq);
+            int location = parity->locate_error(block_size, dp, dq, num_data);
+
+            // blocks that fail their checksum are erasures, decoded from the rest
+            vector<int> bad;
+            for (int k = 0; k < (int)disks.size() && !checksums.empty(); ++k)
             {
-                if (is_parity_block(i, block))
-                    continue;
-                char *data_block = new char[block_size];
-                if (i == disk)
+                char *block_data = k < num_data ? data[k] : k == num_data ? p_block : q_block;
+                if (!verify_checksum(disks[k], block, block_data))
+                    bad.push_back(disks[k]);
+            }
+            if (bad.size() > 2)
+            {
+                errors.push_back({block, -1, false});
+                return 0;
+            }
+            if (!bad.empty())
+            {
+                if (repair && rebuild_row(block, bad))
+                    return -1;
+                for (int disk : bad)
                 {
-                    memset(data_block, 0, block_size);
-                    coef_pow = parity->gf_pow_02(-coef_idx);
+                    errors.push_back({block, disk, repair});
                 }
-                else
+                return 0;
+            }
+
+            if (location == LOCATION_NONE)
+                return 0;
+            ScrubError error = {block, -1, false};
+            if (location == LOCATION_UNKNOWN)
+            {
+                errors.push_back(error);
+                return 0;
+            }
+
+            // the good block is the bad one plus its syndrome
+            char *fixed;
+            if (location == LOCATION_P)
+            {
+                error.disk = disk_p;
+                parity->XOR_block(p_block, dp, block_size, dp);
+                fixed = dp;
+            }
+            else if (location == LOCATION_Q)
+            {
+                error.disk = disk_q;
+                parity->XOR_block(q_block, dq, block_size, dq);
+                fixed = dq;
+            }
+            else
+            {
+                error.disk = disks[location];
+                parity->XOR_block(data[location], dp, block_size, dp);
+                fixed = dp;
+            }
+            if (repair)
+            {
+                if (write(error.disk, block, 0, block_size, fixed))
+                    return -1;
+                error.repaired = true;
+            }
+            errors.push_back(error);
+            return 0;
+        }
+
+        // the rows of a rebuild from first on, a window at a time
+        int rebuild_windows(const vector<int> &targets, int first, RebuildOptions &rebuild_options)
+        {
+            int num_threads = rebuild_options.threads;
+            if (num_threads <= 0)
+                num_threads = std::max(1u, std::thread::hardware_concurrency());
+            int interval = std::max(1, rebuild_options.checkpoint_interval);
+            ThreadPool pool(num_threads);
+            Throttle bandwidth(rebuild_options.max_bytes_per_sec);
+            Throttle iops(rebuild_options.max_stripes_per_sec);
+            // every other member read, the targets written; the geometry does
+            // not change while a rebuild runs
+            double stripe_bytes = (double)num_disks * block_size;
+            int total = num_blocks;
+            auto start = std::chrono::steady_clock::now();
+            for (int window = first; window < total; window += interval)
+            {
+                int end = std::min(total, window + interval);
                 {
-                    if (read(i, block, 0, block_size, data_block))
+                    ReadLock layout_lock(layout_mutex);
+                    std::atomic<int> next(window);
+                    Completion completion(num_threads);
+                    for (int i = 0; i < num_threads; ++i)
+                    {
+                        pool.push([&]()
+                                  {
+                                      int status = 0;
+                                      for (int block = next++; block < end && status == 0; block = next++)
+                                      {
+                                          bandwidth.acquire(stripe_bytes);
+                                          iops.acquire(1);
+                                          WriteLock row_lock(locks.get(block));
+                                          status = rebuild_row(block, targets);
+                                      }
+                                      completion.done(status); });
+                    }
+                    if (completion.wait())
                         return -1;
+                    if (storage->sync() || write_checkpoint(targets, end))
+                        return -1;
+                }
+
+                if (rebuild_options.progress)
+                {
+                    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    double rate = (end - first) / std::max(elapsed, 1e-9);
+                    rebuild_options.progress({end, total, elapsed, (total - end) / rate, rate * stripe_bytes});
                 }
-                data.push_back(data_block);
-                coef_idx++;
             }
-            // Q_x
-            char new_parity[block_size];
-            parity->calculate_parity(policies[1], block_size, data, new_parity);
-            for (int i = 0; i < data.size(); ++i)
+            ReadLock layout_lock(layout_mutex);
+            std::remove(get_checkpoint_path().c_str());
+            for (int target : targets)
             {
-                delete[] data[i];
+                failed[target] = false;
+                rebuilding[target] = false;
             }
+            return 0;
+        }
 
-            // Q
-            char parity_block[block_size];
-            if (read(disk_q, block, 0, block_size, parity_block))
-                return -1;
-
-            // Q+Q_x
-            parity->XOR_block(parity_block, new_parity, block_size, parity_block);
-
-            // (Q+Q_x)*g^(-x)
-            parity->gf_multiply_byte_block(parity_block, coef_pow, block_size, parity_block);
+        // rebuild the blocks of the target disks in one row and write them
+        int rebuild_row(int block, const vector<int> &targets)
+        {
+            ArenaBlocks bufs(*arena);
+            vector<IORequest> batch;
+            for (int target : targets)
+            {
+                batch.push_back({target, block_offset(block), (size_t)block_size, bufs.get()});
+            }
+            if (targets.size() == 1)
+            {
+                if (reconstruct(targets[0], block, batch[0].buf))
+                    return -1;
+                return store_batch(batch);
+            }
 
-            if (write(disk, block, 0, block_size, parity_block))
-                return -1;
-            return 0;
+            // order the pair data first, parity P before Q
+            int disk_p = get_parity_disk(block, 0);
+            if (is_parity_block(batch[0].disk, block) && (!is_parity_block(batch[1].disk, block) || batch[1].disk == disk_p))
+                std::swap(batch[0], batch[1]);
+            int x = batch[0].disk, y = batch[1].disk;
+            if (!is_parity_block(y, block))
+            {
+                if (decode_double(x, y, block, batch[0].buf, batch[1].buf))
+                    return -1;
+            }
+            else if (is_parity_block(x, block))
+            {
+                if (cal_parity(block, batch[0].buf, batch[1].buf))
+                    return -1;
+            }
+            else
+            {
+                // the data block from the other parity, then the parity from the data
+                int policy = y == disk_p ? 0 : 1;
+                int decoded = policy == 0 ? decode_single_q(x, block, batch[0].buf) : decode_single_p(x, block, batch[0].buf);
+                if (decoded || cal_parity_with(block, policy, x, batch[0].buf, batch[1].buf))
+                    return -1;
+            }
+            return store_batch(batch);
         }
     };
 }
\ No newline at end of file
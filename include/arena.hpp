@@ -0,0 +1,113 @@
+#pragma once
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace RAID6
+{
+    // alignment of every arena buffer, enough for O_DIRECT on 4Kn devices
+    constexpr size_t ARENA_ALIGNMENT = 4096;
+
+    // Reusable pool of block sized, 4 KiB aligned buffers.
+    // Buffers go back to the free list instead of the allocator,
+    // so once the pool is warm stripe operations do not allocate.
+    class BlockArena
+    {
+    public:
+        BlockArena(size_t block_size) : block_size(block_size)
+        {
+            buffer_size = (block_size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+        }
+
+        ~BlockArena()
+        {
+            for (char *buf : free_list)
+            {
+                free(buf);
+            }
+        }
+
+        // throws std::bad_alloc like the containers, never hands out null
+        char *acquire()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!free_list.empty())
+                {
+                    char *buf = free_list.back();
+                    free_list.pop_back();
+                    return buf;
+                }
+            }
+            void *buf = nullptr;
+            if (posix_memalign(&buf, ARENA_ALIGNMENT, buffer_size))
+                throw std::bad_alloc();
+            return (char *)buf;
+        }
+
+        void release(char *buf)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            free_list.push_back(buf);
+        }
+
+        size_t get_block_size()
+        {
+            return block_size;
+        }
+
+    private:
+        size_t block_size;
+        size_t buffer_size;
+        std::vector<char *> free_list;
+        std::mutex mutex;
+    };
+
+    // the arena buffers of one operation, handed back on destruction
+    class ArenaBlocks
+    {
+    public:
+        ArenaBlocks(BlockArena &arena) : arena(arena) {}
+        ArenaBlocks(const ArenaBlocks &) = delete;
+        ArenaBlocks &operator=(const ArenaBlocks &) = delete;
+
+        ~ArenaBlocks()
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                arena.release(blocks[i]);
+            }
+            for (char *buf : more)
+            {
+                arena.release(buf);
+            }
+        }
+
+        char *get()
+        {
+            char *buf = arena.acquire();
+            if (count < INLINE_BLOCKS)
+                blocks[count++] = buf;
+            else
+                more.push_back(buf);
+            return buf;
+        }
+
+        char *get_zeroed()
+        {
+            char *buf = get();
+            memset(buf, 0, arena.get_block_size());
+            return buf;
+        }
+
+    private:
+        // enough for the stripes of common arrays without touching the heap
+        static constexpr int INLINE_BLOCKS = 16;
+        BlockArena &arena;
+        char *blocks[INLINE_BLOCKS];
+        int count = 0;
+        std::vector<char *> more;
+    };
+}
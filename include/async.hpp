@@ -0,0 +1,15 @@
+#pragma once
+#include <functional>
+
+namespace RAID6
+{
+    // how an async_get/async_put/async_recover ended
+    struct AsyncResult
+    {
+        int status;     // what the blocking call returns
+        double latency; // seconds from submission to completion, queueing included
+    };
+
+    // called on the executor thread when the operation completed, before its future is ready
+    using AsyncCallback = std::function<void(const AsyncResult &)>;
+}
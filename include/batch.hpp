@@ -0,0 +1,14 @@
+#pragma once
+#include <cstddef>
+
+namespace RAID6
+{
+    // one range of get_batch/put_batch, as the arguments of get/put
+    struct Extent
+    {
+        int disk;
+        size_t position;
+        int len;
+        char *data;
+    };
+}
@@ -0,0 +1,260 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace RAID6
+{
+    // Write-intent bitmap, one bit per region of rows. A bit is made durable
+    // before the first parity update of its region and cleared lazily once the
+    // region is idle and its writes reached the disks, so after a crash only the
+    // regions still set need their parity resynced.
+    // File layout: region size in rows (uint32), then the bits.
+    class WriteIntentBitmap
+    {
+    public:
+        WriteIntentBitmap() {}
+        WriteIntentBitmap(const WriteIntentBitmap &) = delete;
+        WriteIntentBitmap &operator=(const WriteIntentBitmap &) = delete;
+        ~WriteIntentBitmap()
+        {
+            if (fd >= 0)
+                ::close(fd);
+        }
+
+        // the region size of an existing file wins over region_blocks; opened
+        // again with more blocks, the set bits are kept
+        int open(const std::string &file_path, int num_blocks, int region_blocks)
+        {
+            if (fd >= 0)
+                ::close(fd);
+            fd = ::open(file_path.c_str(), O_RDWR | O_CREAT, 0644);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st))
+            {
+                std::cerr << "Error: failed to open bitmap file" << std::endl;
+                return -1;
+            }
+            uint32_t stored = 0;
+            bool existing = st.st_size >= (off_t)sizeof(stored) && pread(fd, &stored, sizeof(stored), 0) == sizeof(stored) && stored > 0;
+            this->region_blocks = existing ? stored : std::max(1, region_blocks);
+            num_idle = 0;
+            int num_regions = (num_blocks + this->region_blocks - 1) / this->region_blocks;
+            bits.assign((num_regions + 7) / 8, 0);
+            in_flight.assign(num_regions, 0);
+            generation.assign(num_regions, 0);
+            set_at.assign(num_regions, 0);
+            written = 0;
+            synced = 0;
+            if (existing)
+            {
+                // a shorter file reads as clear
+                ssize_t n = pread(fd, bits.data(), bits.size(), sizeof(stored));
+                if (n < 0)
+                    n = 0;
+                std::fill(bits.begin() + n, bits.end(), 0);
+                for (int region = 0; region < num_regions; ++region)
+                {
+                    if (is_set(region))
+                        num_idle++;
+                }
+                return 0;
+            }
+            stored = this->region_blocks;
+            if (ftruncate(fd, 0) || pwrite(fd, &stored, sizeof(stored), 0) != sizeof(stored) ||
+                pwrite(fd, bits.data(), bits.size(), sizeof(stored)) != (ssize_t)bits.size() || fdatasync(fd))
+            {
+                std::cerr << "Error: failed to write bitmap file" << std::endl;
+                return -1;
+            }
+            return 0;
+        }
+
+        int get_region_blocks()
+        {
+            return region_blocks;
+        }
+
+        // regions set in the file
+        std::vector<int> dirty_regions()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<int> regions;
+            for (int region = 0; region < (int)in_flight.size(); ++region)
+            {
+                if (is_set(region))
+                    regions.push_back(region);
+            }
+            return regions;
+        }
+
+        // before a parity update of block, the bit is durable when this returns
+        int mark(int block)
+        {
+            int region = block / region_blocks;
+            uint64_t needed;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (in_flight[region]++ == 0 && is_set(region))
+                    num_idle--;
+                generation[region]++;
+                if (!is_set(region))
+                {
+                    bits[region / 8] |= 1 << (region % 8);
+                    if (write_byte(region))
+                    {
+                        // not in the file, so not set: the next mark writes it again
+                        bits[region / 8] &= ~(1 << (region % 8));
+                        std::cerr << "Error: failed to write bitmap file" << std::endl;
+                        return -1;
+                    }
+                    set_at[region] = ++written;
+                }
+                // a bit set by another mark may not be durable yet either
+                needed = set_at[region];
+            }
+            return wait_durable(needed);
+        }
+
+        // after the parity update of block completed
+        void done(int block)
+        {
+            int region = block / region_blocks;
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--in_flight[region] == 0 && is_set(region))
+                num_idle++;
+        }
+
+        // set regions without writes in flight
+        int idle_regions()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return num_idle;
+        }
+
+        // Clearing is two phase: take the idle regions, make the disks durable,
+        // then clear those not written again in between.
+        std::vector<std::pair<int, int>> begin_clear()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<std::pair<int, int>> idle;
+            for (int region = 0; region < (int)in_flight.size(); ++region)
+            {
+                if (is_set(region) && in_flight[region] == 0)
+                    idle.push_back({region, generation[region]});
+            }
+            return idle;
+        }
+
+        int end_clear(const std::vector<std::pair<int, int>> &idle)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto &entry : idle)
+            {
+                int region = entry.first;
+                // skip regions written again or cleared by a concurrent clear
+                if (in_flight[region] != 0 || generation[region] != entry.second || !is_set(region))
+                    continue;
+                bits[region / 8] &= ~(1 << (region % 8));
+                num_idle--;
+                if (write_byte(region))
+                {
+                    std::cerr << "Error: failed to write bitmap file" << std::endl;
+                    return -1;
+                }
+            }
+            // a clear bit that does not reach the disk only costs a resync
+            return 0;
+        }
+
+    private:
+        int fd = -1;
+        int region_blocks = 1;
+        // the bits as in the file
+        std::vector<uint8_t> bits;
+        // parity updates running per region
+        std::vector<int> in_flight;
+        // bumped by every mark, tells begin_clear/end_clear about new writes
+        std::vector<int> generation;
+        int num_idle = 0;
+        std::mutex mutex;
+        // bit writes issued, the write that set each region's bit (0 when
+        // loaded from the file), and the writes an fdatasync covered
+        uint64_t written = 0;
+        std::vector<uint64_t> set_at;
+        std::atomic<uint64_t> synced{0};
+        // one sync at a time, taken before mutex
+        std::mutex sync_mutex;
+
+        bool is_set(int region)
+        {
+            return bits[region / 8] & (1 << (region % 8));
+        }
+
+        // Group commit of set bits: one fdatasync covers every write issued
+        // before it, so marks arriving during a sync share the next one, and
+        // the bitmap mutex is never held across a sync.
+        int wait_durable(uint64_t needed)
+        {
+            if (needed <= synced)
+                return 0;
+            std::lock_guard<std::mutex> lock(sync_mutex);
+            if (needed <= synced)
+                return 0;
+            uint64_t target;
+            {
+                std::lock_guard<std::mutex> bits_lock(mutex);
+                target = written;
+            }
+            if (fdatasync(fd))
+            {
+                std::cerr << "Error: failed to write bitmap file" << std::endl;
+                return -1;
+            }
+            synced = target;
+            return 0;
+        }
+
+        int write_byte(int region)
+        {
+            off_t pos = sizeof(uint32_t) + region / 8;
+            return pwrite(fd, &bits[region / 8], 1, pos) == 1 ? 0 : -1;
+        }
+    };
+
+    // marks a row in the bitmap for the lifetime of a parity update
+    class WriteIntent
+    {
+    public:
+        WriteIntent(WriteIntentBitmap *bitmap, int block) : bitmap(bitmap), block(block)
+        {
+            if (bitmap)
+                status = bitmap->mark(block);
+        }
+        WriteIntent(const WriteIntent &) = delete;
+        WriteIntent &operator=(const WriteIntent &) = delete;
+        ~WriteIntent()
+        {
+            if (bitmap)
+                bitmap->done(block);
+        }
+
+        // non-zero when the bit could not be made durable
+        int get_status()
+        {
+            return status;
+        }
+
+    private:
+        WriteIntentBitmap *bitmap;
+        int block;
+        int status = 0;
+    };
+}
@@ -0,0 +1,219 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "options.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RAID6_X86 1
+#endif
+
+namespace RAID6
+{
+    // CRC32C (Castagnoli), reflected polynomial
+    constexpr uint32_t CRC32C_POLY = 0x82F63B78;
+
+    // slicing-by-8 tables, table[k][b] is the CRC of byte b followed by k zero bytes
+    struct CRC32CTables
+    {
+        uint32_t table[8][256];
+    };
+
+    constexpr CRC32CTables generate_crc32c_tables()
+    {
+        CRC32CTables t{};
+        for (uint32_t b = 0; b < 256; ++b)
+        {
+            uint32_t crc = b;
+            for (int i = 0; i < 8; ++i)
+            {
+                crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+            }
+            t.table[0][b] = crc;
+        }
+        for (int k = 1; k < 8; ++k)
+        {
+            for (int b = 0; b < 256; ++b)
+            {
+                uint32_t prev = t.table[k - 1][b];
+                t.table[k][b] = (prev >> 8) ^ t.table[0][prev & 0xff];
+            }
+        }
+        return t;
+    }
+
+    inline constexpr CRC32CTables crc32c_tables = generate_crc32c_tables();
+
+    namespace kernels
+    {
+        inline uint32_t crc32c_scalar(uint32_t crc, const char *data, size_t len)
+        {
+            const unsigned char *p = (const unsigned char *)data;
+            auto &t = crc32c_tables.table;
+            crc = ~crc;
+            for (; len >= 8; len -= 8, p += 8)
+            {
+                uint32_t lo, hi;
+                memcpy(&lo, p, 4);
+                memcpy(&hi, p + 4, 4);
+                lo ^= crc;
+                crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+                      t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+            }
+            for (; len > 0; --len, ++p)
+            {
+                crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xff];
+            }
+            return ~crc;
+        }
+
+#if defined(RAID6_X86) && defined(__x86_64__)
+        // the SSE4.2 crc32 instruction, 8 bytes at a time
+        __attribute__((target("sse4.2"))) inline uint32_t crc32c_sse42(uint32_t crc, const char *data, size_t len)
+        {
+            uint64_t c = ~crc;
+            for (; len >= 8; len -= 8, data += 8)
+            {
+                uint64_t v;
+                memcpy(&v, data, 8);
+                c = _mm_crc32_u64(c, v);
+            }
+            uint32_t c32 = c;
+            for (; len > 0; --len, ++data)
+            {
+                c32 = _mm_crc32_u8(c32, *data);
+            }
+            return ~c32;
+        }
+#endif
+
+        using CRC32CFunction = uint32_t (*)(uint32_t, const char *, size_t);
+
+        inline CRC32CFunction best_crc32c()
+        {
+#if defined(RAID6_X86) && defined(__x86_64__)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("sse4.2"))
+                return crc32c_sse42;
+#endif
+            return crc32c_scalar;
+        }
+    }
+
+    // CRC32C of a buffer, continuing from crc
+    inline uint32_t crc32c(const char *data, size_t len, uint32_t crc = 0)
+    {
+        static const kernels::CRC32CFunction function = kernels::best_crc32c();
+        return function(crc, data, len);
+    }
+
+    // The CRC32C of every block of one disk, kept in memory and written
+    // through to a sidecar file of num_blocks 32 bit values.
+    class ChecksumFile
+    {
+    public:
+        ChecksumFile() {}
+        ChecksumFile(const ChecksumFile &) = delete;
+        ChecksumFile &operator=(const ChecksumFile &) = delete;
+        ~ChecksumFile()
+        {
+            close();
+        }
+
+        // valid is false for a new file or one of the wrong size, its values are then unset
+        int open(const std::string &file_path, int num_blocks, bool &valid)
+        {
+            close();
+            fd = ::open(file_path.c_str(), O_RDWR | O_CREAT, 0644);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st))
+            {
+                std::cerr << "Error: failed to open checksum file" << std::endl;
+                return -1;
+            }
+            size_t size = (size_t)num_blocks * sizeof(uint32_t);
+            crcs.assign(num_blocks, 0);
+            valid = st.st_size == (off_t)size;
+            if (valid && pread(fd, crcs.data(), size, 0) != (ssize_t)size)
+                valid = false;
+            if (!valid && ftruncate(fd, size))
+            {
+                std::cerr << "Error: failed to size checksum file" << std::endl;
+                return -1;
+            }
+            return 0;
+        }
+
+        void close()
+        {
+            if (fd >= 0)
+                ::close(fd);
+            fd = -1;
+        }
+
+        uint32_t get(int block)
+        {
+            return crcs[block];
+        }
+
+        int set(int block, uint32_t crc, SyncPolicy sync_policy)
+        {
+            crcs[block] = crc;
+            if (pwrite(fd, &crc, sizeof(crc), (off_t)block * sizeof(crc)) != sizeof(crc))
+            {
+                std::cerr << "Error: failed to write checksum file" << std::endl;
+                return -1;
+            }
+            return sync_policy == SYNC_NONE ? 0 : sync();
+        }
+
+        // replace every value at once
+        int assign(const std::vector<uint32_t> &values)
+        {
+            crcs = values;
+            size_t size = crcs.size() * sizeof(uint32_t);
+            if (pwrite(fd, crcs.data(), size, 0) != (ssize_t)size)
+            {
+                std::cerr << "Error: failed to write checksum file" << std::endl;
+                return -1;
+            }
+            return 0;
+        }
+
+        // blocks added at the end, each with the value crc
+        int extend(int num_blocks, uint32_t crc)
+        {
+            size_t old = crcs.size();
+            crcs.resize(std::max<size_t>(old, num_blocks), crc);
+            size_t size = (crcs.size() - old) * sizeof(uint32_t);
+            if (pwrite(fd, crcs.data() + old, size, old * sizeof(uint32_t)) != (ssize_t)size)
+            {
+                std::cerr << "Error: failed to write checksum file" << std::endl;
+                return -1;
+            }
+            return 0;
+        }
+
+        int sync()
+        {
+            if (fdatasync(fd))
+            {
+                std::cerr << "Error: failed to sync checksum file" << std::endl;
+                return -1;
+            }
+            return 0;
+        }
+
+    private:
+        int fd = -1;
+        std::vector<uint32_t> crcs;
+    };
+}
@@ -0,0 +1,364 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RAID6_X86 1
+#endif
+
+namespace RAID6
+{
+    // Block kernels for GF(2^8) arithmetic.
+    // A coefficient c is passed as a 32 byte split-nibble table:
+    // tbl[0..15] = c * x for x in [0, 16), tbl[16..31] = c * (x << 4).
+    // c * b is then tbl[b & 0x0f] ^ tbl[16 + (b >> 4)], which maps to pshufb.
+    struct GFKernel
+    {
+        const char *name;
+        // result = a ^ b
+        void (*xor_block)(const char *a, const char *b, size_t len, char *result);
+        // result = c * a
+        void (*mul_block)(const char *a, const unsigned char *tbl, size_t len, char *result);
+        // result ^= c * a
+        void (*mul_xor_block)(const char *a, const unsigned char *tbl, size_t len, char *result);
+        // p = sum of data[i], q = sum of g^i * data[i], in one pass over the data
+        void (*gen_syndrome)(size_t len, int ndata, char *const *data, char *p, char *q);
+    };
+
+    namespace kernels
+    {
+        inline unsigned char mul_nibble(const unsigned char *tbl, unsigned char b)
+        {
+            return tbl[b & 0x0f] ^ tbl[16 + (b >> 4)];
+        }
+
+        // scalar fallback, also used for the tails of the SIMD kernels
+        inline void scalar_xor_block(const char *a, const char *b, size_t len, char *result)
+        {
+            for (size_t i = 0; i < len; i++)
+            {
+                result[i] = a[i] ^ b[i];
+            }
+        }
+        inline void scalar_mul_block(const char *a, const unsigned char *tbl, size_t len, char *result)
+        {
+            for (size_t i = 0; i < len; i++)
+            {
+                result[i] = mul_nibble(tbl, a[i]);
+            }
+        }
+        inline void scalar_mul_xor_block(const char *a, const unsigned char *tbl, size_t len, char *result)
+        {
+            for (size_t i = 0; i < len; i++)
+            {
+                result[i] ^= mul_nibble(tbl, a[i]);
+            }
+        }
+
+        // Horner's scheme, highest data index first: q = (..(D[n-1] * g + D[n-2]) * g ..) + D[0]
+        inline void scalar_gen_syndrome(size_t len, int ndata, char *const *data, char *p, char *q)
+        {
+            const uint64_t high = 0x8080808080808080ull;
+            const uint64_t poly = 0x1d1d1d1d1d1d1d1dull;
+            size_t i = 0;
+            for (; i + 8 <= len; i += 8)
+            {
+                uint64_t wp, wq;
+                memcpy(&wp, data[ndata - 1] + i, 8);
+                wq = wp;
+                for (int d = ndata - 2; d >= 0; --d)
+                {
+                    uint64_t w;
+                    memcpy(&w, data[d] + i, 8);
+                    // multiply every byte of wq by g = 0x02
+                    uint64_t m = wq & high;
+                    m = (m << 1) - (m >> 7);
+                    wq = ((wq << 1) & ~0x0101010101010101ull) ^ (m & poly);
+                    wp ^= w;
+                    wq ^= w;
+                }
+                memcpy(p + i, &wp, 8);
+                memcpy(q + i, &wq, 8);
+            }
+            for (; i < len; ++i)
+            {
+                unsigned char bp = data[ndata - 1][i];
+                unsigned char bq = bp;
+                for (int d = ndata - 2; d >= 0; --d)
+                {
+                    bq = (bq << 1) ^ ((bq & 0x80) ? 0x1d : 0);
+                    bp ^= data[d][i];
+                    bq ^= data[d][i];
+                }
+                p[i] = bp;
+                q[i] = bq;
+            }
+        }
+
+#ifdef RAID6_X86
+        __attribute__((target("ssse3"))) inline __m128i ssse3_mul(__m128i x, __m128i lo, __m128i hi)
+        {
+            const __m128i mask = _mm_set1_epi8(0x0f);
+            __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(x, mask));
+            __m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(x, 4), mask));
+            return _mm_xor_si128(l, h);
+        }
+        __attribute__((target("ssse3"))) inline void ssse3_xor_block(const char *a, const char *b, size_t len, char *result)
+        {
+            size_t i = 0;
+            for (; i + 16 <= len; i += 16)
+            {
+                __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+                __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+                _mm_storeu_si128((__m128i *)(result + i), _mm_xor_si128(x, y));
+            }
+            scalar_xor_block(a + i, b + i, len - i, result + i);
+        }
+        __attribute__((target("ssse3"))) inline void ssse3_mul_block(const char *a, const unsigned char *tbl, size_t len, char *result)
+        {
+            const __m128i lo = _mm_loadu_si128((const __m128i *)tbl);
+            const __m128i hi = _mm_loadu_si128((const __m128i *)(tbl + 16));
+            size_t i = 0;
+            for (; i + 16 <= len; i += 16)
+            {
+                __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+                _mm_storeu_si128((__m128i *)(result + i), ssse3_mul(x, lo, hi));
+            }
+            scalar_mul_block(a + i, tbl, len - i, result + i);
+        }
+        __attribute__((target("ssse3"))) inline void ssse3_mul_xor_block(const char *a, const unsigned char *tbl, size_t len, char *result)
+        {
+            const __m128i lo = _mm_loadu_si128((const __m128i *)tbl);
+            const __m128i hi = _mm_loadu_si128((const __m128i *)(tbl + 16));
+            size_t i = 0;
+            for (; i + 16 <= len; i += 16)
+            {
+                __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+                __m128i r = _mm_loadu_si128((const __m128i *)(result + i));
+                _mm_storeu_si128((__m128i *)(result + i), _mm_xor_si128(r, ssse3_mul(x, lo, hi)));
+            }
+            scalar_mul_xor_block(a + i, tbl, len - i, result + i);
+        }
+        __attribute__((target("ssse3"))) inline void ssse3_gen_syndrome(size_t len, int ndata, char *const *data, char *p, char *q)
+        {
+            const __m128i poly = _mm_set1_epi8(0x1d);
+            const __m128i zero = _mm_setzero_si128();
+            size_t i = 0;
+            for (; i + 16 <= len; i += 16)
+            {
+                __m128i wp = _mm_loadu_si128((const __m128i *)(data[ndata - 1] + i));
+                __m128i wq = wp;
+                for (int d = ndata - 2; d >= 0; --d)
+                {
+                    __m128i w = _mm_loadu_si128((const __m128i *)(data[d] + i));
+                    __m128i m = _mm_and_si128(_mm_cmpgt_epi8(zero, wq), poly);
+                    wq = _mm_xor_si128(_mm_add_epi8(wq, wq), m);
+                    wp = _mm_xor_si128(wp, w);
+                    wq = _mm_xor_si128(wq, w);
+                }
+                _mm_storeu_si128((__m128i *)(p + i), wp);
+                _mm_storeu_si128((__m128i *)(q + i), wq);
+            }
+            if (i < len)
+            {
+                char *tail[256];
+                for (int d = 0; d < ndata; ++d)
+                    tail[d] = data[d] + i;
+                scalar_gen_syndrome(len - i, ndata, tail, p + i, q + i);
+            }
+        }
+
+        __attribute__((target("avx2"))) inline __m256i avx2_mul(__m256i x, __m256i lo, __m256i hi)
+        {
+            const __m256i mask = _mm256_set1_epi8(0x0f);
+            __m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(x, mask));
+            __m256i h = _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask));
+            return _mm256_xor_si256(l, h);
+        }
+        __attribute__((target("avx2"))) inline void avx2_xor_block(const char *a, const char *b, size_t len, char *result)
+        {
+            size_t i = 0;
+            for (; i + 32 <= len; i += 32)
+            {
+                __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+                __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+                _mm256_storeu_si256((__m256i *)(result + i), _mm256_xor_si256(x, y));
+            }
+            scalar_xor_block(a + i, b + i, len - i, result + i);
+        }
+        __attribute__((target("avx2"))) inline void avx2_mul_block(const char *a, const unsigned char *tbl, size_t len, char *result)
+        {
+            // the same 16 byte table in both lanes, pshufb works per lane
+            const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)tbl));
+            const __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(tbl + 16)));
+            size_t i = 0;
+            for (; i + 32 <= len; i += 32)
+            {
+                __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+                _mm256_storeu_si256((__m256i *)(result + i), avx2_mul(x, lo, hi));
+            }
+            scalar_mul_block(a + i, tbl, len - i, result + i);
+        }
+        __attribute__((target("avx2"))) inline void avx2_mul_xor_block(const char *a, const unsigned char *tbl, size_t len, char *result)
+        {
+            const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)tbl));
+            const __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(tbl + 16)));
+            size_t i = 0;
+            for (; i + 32 <= len; i += 32)
+            {
+                __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+                __m256i r = _mm256_loadu_si256((const __m256i *)(result + i));
+                _mm256_storeu_si256((__m256i *)(result + i), _mm256_xor_si256(r, avx2_mul(x, lo, hi)));
+            }
+            scalar_mul_xor_block(a + i, tbl, len - i, result + i);
+        }
+        __attribute__((target("avx2"))) inline void avx2_gen_syndrome(size_t len, int ndata, char *const *data, char *p, char *q)
+        {
+            const __m256i poly = _mm256_set1_epi8(0x1d);
+            const __m256i zero = _mm256_setzero_si256();
+            size_t i = 0;
+            for (; i + 32 <= len; i += 32)
+            {
+                __m256i wp = _mm256_loadu_si256((const __m256i *)(data[ndata - 1] + i));
+                __m256i wq = wp;
+                for (int d = ndata - 2; d >= 0; --d)
+                {
+                    __m256i w = _mm256_loadu_si256((const __m256i *)(data[d] + i));
+                    __m256i m = _mm256_and_si256(_mm256_cmpgt_epi8(zero, wq), poly);
+                    wq = _mm256_xor_si256(_mm256_add_epi8(wq, wq), m);
+                    wp = _mm256_xor_si256(wp, w);
+                    wq = _mm256_xor_si256(wq, w);
+                }
+                _mm256_storeu_si256((__m256i *)(p + i), wp);
+                _mm256_storeu_si256((__m256i *)(q + i), wq);
+            }
+            if (i < len)
+            {
+                char *tail[256];
+                for (int d = 0; d < ndata; ++d)
+                    tail[d] = data[d] + i;
+                scalar_gen_syndrome(len - i, ndata, tail, p + i, q + i);
+            }
+        }
+
+        // The unmasked GCC intrinsics of broadcast and shift merge into an
+        // _mm512_undefined_epi32(), which warns as uninitialized; the masked
+        // forms below take an explicit zero vector instead.
+        __attribute__((target("avx512f,avx512bw"))) inline __m512i avx512_table(const unsigned char *half)
+        {
+            return _mm512_mask_broadcast_i32x4(_mm512_setzero_si512(), (__mmask16)-1, _mm_loadu_si128((const __m128i *)half));
+        }
+        __attribute__((target("avx512f,avx512bw"))) inline __m512i avx512_mul(__m512i x, __m512i lo, __m512i hi)
+        {
+            const __m512i mask = _mm512_set1_epi8(0x0f);
+            __m512i shifted = _mm512_mask_srli_epi64(_mm512_setzero_si512(), (__mmask8)-1, x, 4);
+            __m512i l = _mm512_shuffle_epi8(lo, _mm512_and_si512(x, mask));
+            __m512i h = _mm512_shuffle_epi8(hi, _mm512_and_si512(shifted, mask));
+            return _mm512_xor_si512(l, h);
+        }
+        __attribute__((target("avx512f,avx512bw"))) inline void avx512_xor_block(const char *a, const char *b, size_t len, char *result)
+        {
+            size_t i = 0;
+            for (; i + 64 <= len; i += 64)
+            {
+                __m512i x = _mm512_loadu_si512((const void *)(a + i));
+                __m512i y = _mm512_loadu_si512((const void *)(b + i));
+                _mm512_storeu_si512((void *)(result + i), _mm512_xor_si512(x, y));
+            }
+            scalar_xor_block(a + i, b + i, len - i, result + i);
+        }
+        __attribute__((target("avx512f,avx512bw"))) inline void avx512_mul_block(const char *a, const unsigned char *tbl, size_t len, char *result)
+        {
+            const __m512i lo = avx512_table(tbl);
+            const __m512i hi = avx512_table(tbl + 16);
+            size_t i = 0;
+            for (; i + 64 <= len; i += 64)
+            {
+                __m512i x = _mm512_loadu_si512((const void *)(a + i));
+                _mm512_storeu_si512((void *)(result + i), avx512_mul(x, lo, hi));
+            }
+            scalar_mul_block(a + i, tbl, len - i, result + i);
+        }
+        __attribute__((target("avx512f,avx512bw"))) inline void avx512_mul_xor_block(const char *a, const unsigned char *tbl, size_t len, char *result)
+        {
+            const __m512i lo = avx512_table(tbl);
+            const __m512i hi = avx512_table(tbl + 16);
+            size_t i = 0;
+            for (; i + 64 <= len; i += 64)
+            {
+                __m512i x = _mm512_loadu_si512((const void *)(a + i));
+                __m512i r = _mm512_loadu_si512((const void *)(result + i));
+                _mm512_storeu_si512((void *)(result + i), _mm512_xor_si512(r, avx512_mul(x, lo, hi)));
+            }
+            scalar_mul_xor_block(a + i, tbl, len - i, result + i);
+        }
+        __attribute__((target("avx512f,avx512bw"))) inline void avx512_gen_syndrome(size_t len, int ndata, char *const *data, char *p, char *q)
+        {
+            const __m512i poly = _mm512_set1_epi8(0x1d);
+            const __m512i zero = _mm512_setzero_si512();
+            size_t i = 0;
+            for (; i + 64 <= len; i += 64)
+            {
+                __m512i wp = _mm512_loadu_si512((const void *)(data[ndata - 1] + i));
+                __m512i wq = wp;
+                for (int d = ndata - 2; d >= 0; --d)
+                {
+                    __m512i w = _mm512_loadu_si512((const void *)(data[d] + i));
+                    __m512i m = _mm512_mask_blend_epi8(_mm512_movepi8_mask(wq), zero, poly);
+                    wq = _mm512_xor_si512(_mm512_add_epi8(wq, wq), m);
+                    wp = _mm512_xor_si512(wp, w);
+                    wq = _mm512_xor_si512(wq, w);
+                }
+                _mm512_storeu_si512((void *)(p + i), wp);
+                _mm512_storeu_si512((void *)(q + i), wq);
+            }
+            if (i < len)
+            {
+                char *tail[256];
+                for (int d = 0; d < ndata; ++d)
+                    tail[d] = data[d] + i;
+                scalar_gen_syndrome(len - i, ndata, tail, p + i, q + i);
+            }
+        }
+#endif
+
+        inline const GFKernel &scalar()
+        {
+            static const GFKernel k = {"scalar", scalar_xor_block, scalar_mul_block, scalar_mul_xor_block, scalar_gen_syndrome};
+            return k;
+        }
+
+        // every kernel the running CPU can execute, slowest first
+        inline const std::vector<const GFKernel *> &available()
+        {
+            static const std::vector<const GFKernel *> list = []()
+            {
+                std::vector<const GFKernel *> l;
+                l.push_back(&scalar());
+#ifdef RAID6_X86
+                static const GFKernel ssse3 = {"ssse3", ssse3_xor_block, ssse3_mul_block, ssse3_mul_xor_block, ssse3_gen_syndrome};
+                static const GFKernel avx2 = {"avx2", avx2_xor_block, avx2_mul_block, avx2_mul_xor_block, avx2_gen_syndrome};
+                static const GFKernel avx512 = {"avx512", avx512_xor_block, avx512_mul_block, avx512_mul_xor_block, avx512_gen_syndrome};
+                __builtin_cpu_init();
+                if (__builtin_cpu_supports("ssse3"))
+                    l.push_back(&ssse3);
+                if (__builtin_cpu_supports("avx2"))
+                    l.push_back(&avx2);
+                if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+                    l.push_back(&avx512);
+#endif
+                return l;
+            }();
+            return list;
+        }
+
+        // widest kernel supported by the running CPU
+        inline const GFKernel &best()
+        {
+            return *available().back();
+        }
+    }
+}
@@ -0,0 +1,480 @@
+#pragma once
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "options.hpp"
+#include "thread_pool.hpp"
+
+namespace RAID6
+{
+    // one member disk transfer of a stripe operation
+    struct IORequest
+    {
+        int disk;
+        off_t pos;
+        size_t len;
+        char *buf;
+        bool write = false;
+        // set by coalesce(): len bytes scattered over iovcnt buffers instead of buf
+        const iovec *iov = nullptr;
+        int iovcnt = 0;
+    };
+
+    // Linux UIO_MAXIOV, the most buffers one preadv/pwritev takes
+    constexpr int MAX_IOVECS = 1024;
+
+    inline int pread_full(int fd, char *data, size_t len, off_t pos)
+    {
+        while (len > 0)
+        {
+            ssize_t n = pread(fd, data, len, pos);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+            {
+                std::cerr << "Error: failed to read disk" << std::endl;
+                return -1;
+            }
+            if (n == 0)
+            {
+                // past the end of the file
+                memset(data, 0, len);
+                break;
+            }
+            data += n;
+            len -= n;
+            pos += n;
+        }
+        return 0;
+    }
+
+    inline int pwrite_full(int fd, const char *data, size_t len, off_t pos)
+    {
+        while (len > 0)
+        {
+            ssize_t n = pwrite(fd, data, len, pos);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                std::cerr << "Error: failed to write disk" << std::endl;
+                return -1;
+            }
+            data += n;
+            len -= n;
+            pos += n;
+        }
+        return 0;
+    }
+
+    // the bytes of a vectored request from skip on, with preadv/pwritev
+    inline int transfer_vector(int fd, const IORequest &req, size_t skip = 0)
+    {
+        std::vector<iovec> iov(req.iov, req.iov + req.iovcnt);
+        size_t k = 0;
+        off_t pos = req.pos + skip;
+        size_t left = req.len - skip;
+        while (left > 0)
+        {
+            // drop what moved already from the front of the vector
+            while (skip >= iov[k].iov_len)
+                skip -= iov[k++].iov_len;
+            iov[k].iov_base = (char *)iov[k].iov_base + skip;
+            iov[k].iov_len -= skip;
+            ssize_t n = req.write ? pwritev(fd, &iov[k], iov.size() - k, pos) : preadv(fd, &iov[k], iov.size() - k, pos);
+            if (n < 0 && errno == EINTR)
+            {
+                skip = 0;
+                continue;
+            }
+            if (n < 0 || (n == 0 && req.write))
+            {
+                std::cerr << "Error: failed to " << (req.write ? "write" : "read") << " disk" << std::endl;
+                return -1;
+            }
+            if (n == 0)
+            {
+                // past the end of the file
+                for (; k < iov.size(); ++k)
+                {
+                    memset(iov[k].iov_base, 0, iov[k].iov_len);
+                }
+                break;
+            }
+            skip = n;
+            left -= n;
+            pos += n;
+        }
+        return 0;
+    }
+
+    inline int run_request(int fd, const IORequest &req)
+    {
+        if (req.iov)
+            return transfer_vector(fd, req);
+        if (req.write)
+            return pwrite_full(fd, req.buf, req.len, req.pos);
+        return pread_full(fd, req.buf, req.len, req.pos);
+    }
+
+    // Merge the requests of one disk and direction that continue each other into
+    // vectored ones, e.g. the blocks of consecutive rows on a disk. iovecs holds
+    // the vectors until the merged batch completed.
+    inline std::vector<IORequest> coalesce(const std::vector<IORequest> &batch, std::vector<std::vector<iovec>> &iovecs)
+    {
+        std::vector<size_t> order(batch.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                         {
+                             const IORequest &x = batch[a], &y = batch[b];
+                             if (x.disk != y.disk)
+                                 return x.disk < y.disk;
+                             if (x.write != y.write)
+                                 return x.write < y.write;
+                             return x.pos < y.pos; });
+        std::vector<IORequest> runs;
+        for (size_t i = 0; i < order.size();)
+        {
+            const IORequest &first = batch[order[i]];
+            off_t end = first.pos + first.len;
+            size_t j = i + 1;
+            for (; j < order.size() && j - i < MAX_IOVECS; ++j)
+            {
+                const IORequest &next = batch[order[j]];
+                if (next.disk != first.disk || next.write != first.write || next.pos != end || next.iov)
+                    break;
+                end += next.len;
+            }
+            if (j - i == 1 || first.iov)
+            {
+                runs.push_back(first);
+                i++;
+                continue;
+            }
+            std::vector<iovec> iov;
+            for (size_t k = i; k < j; ++k)
+            {
+                iov.push_back({batch[order[k]].buf, batch[order[k]].len});
+            }
+            iovecs.push_back(std::move(iov));
+            IORequest run = first;
+            run.len = end - first.pos;
+            run.iov = iovecs.back().data();
+            run.iovcnt = j - i;
+            runs.push_back(run);
+            i = j;
+        }
+        return runs;
+    }
+
+    // runs a batch of requests against the disk descriptors and returns when all completed
+    class IOEngine
+    {
+    public:
+        virtual ~IOEngine() {}
+        virtual const char *name() = 0;
+        virtual int submit(const std::vector<int> &fds, std::vector<IORequest> &batch) = 0;
+    };
+
+    class SyncEngine : public IOEngine
+    {
+    public:
+        const char *name() override
+        {
+            return "sync";
+        }
+
+        int submit(const std::vector<int> &fds, std::vector<IORequest> &batch) override
+        {
+            for (auto &req : batch)
+            {
+                if (run_request(fds[req.disk], req))
+                    return -1;
+            }
+            return 0;
+        }
+    };
+
+    class ThreadPoolEngine : public IOEngine
+    {
+    public:
+        ThreadPoolEngine(int num_threads) : pool(num_threads) {}
+
+        const char *name() override
+        {
+            return "threads";
+        }
+
+        int submit(const std::vector<int> &fds, std::vector<IORequest> &batch) override
+        {
+            if (batch.size() <= 1)
+                return batch.empty() ? 0 : run_request(fds[batch[0].disk], batch[0]);
+            // the calling thread takes the first request itself
+            Completion completion(batch.size() - 1);
+            for (int i = 1; i < (int)batch.size(); ++i)
+            {
+                IORequest *req = &batch[i];
+                int fd = fds[req->disk];
+                pool.push([fd, req, &completion]()
+                          { completion.done(run_request(fd, *req)); });
+            }
+            int status = run_request(fds[batch[0].disk], batch[0]);
+            if (completion.wait())
+                return -1;
+            return status;
+        }
+
+    private:
+        ThreadPool pool;
+    };
+
+    // one io_uring through the raw system calls, used by one thread at a time
+    class UringRing
+    {
+    public:
+        UringRing() {}
+        UringRing(const UringRing &) = delete;
+        UringRing &operator=(const UringRing &) = delete;
+        ~UringRing()
+        {
+            if (sqes)
+                munmap(sqes, sqes_size);
+            if (cq_ptr && cq_ptr != sq_ptr)
+                munmap(cq_ptr, cq_size);
+            if (sq_ptr)
+                munmap(sq_ptr, sq_size);
+            if (ring_fd >= 0)
+                close(ring_fd);
+        }
+
+        // false when the kernel does not offer io_uring
+        bool setup(unsigned queue_depth)
+        {
+            io_uring_params params;
+            memset(&params, 0, sizeof(params));
+            ring_fd = syscall(__NR_io_uring_setup, queue_depth, &params);
+            if (ring_fd < 0)
+                return false;
+            depth = params.sq_entries;
+
+            sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+            if (single_mmap)
+                sq_size = cq_size = std::max(sq_size, cq_size);
+            sq_ptr = map_ring(sq_size, IORING_OFF_SQ_RING);
+            if (!sq_ptr)
+                return false;
+            cq_ptr = single_mmap ? sq_ptr : map_ring(cq_size, IORING_OFF_CQ_RING);
+            if (!cq_ptr)
+                return false;
+            sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+            sqes = (io_uring_sqe *)map_ring(sqes_size, IORING_OFF_SQES);
+            if (!sqes)
+                return false;
+
+            sq_tail = (unsigned *)(sq_ptr + params.sq_off.tail);
+            sq_mask = *(unsigned *)(sq_ptr + params.sq_off.ring_mask);
+            sq_array = (unsigned *)(sq_ptr + params.sq_off.array);
+            cq_head = (unsigned *)(cq_ptr + params.cq_off.head);
+            cq_tail = (unsigned *)(cq_ptr + params.cq_off.tail);
+            cq_mask = *(unsigned *)(cq_ptr + params.cq_off.ring_mask);
+            cqes = (io_uring_cqe *)(cq_ptr + params.cq_off.cqes);
+            return true;
+        }
+
+        int submit(const std::vector<int> &fds, std::vector<IORequest> &batch)
+        {
+            int status = 0;
+            // batches larger than the ring go in windows of queue depth
+            for (size_t first = 0; first < batch.size(); first += depth)
+            {
+                size_t count = std::min((size_t)depth, batch.size() - first);
+                unsigned tail = *sq_tail;
+                for (size_t i = 0; i < count; ++i)
+                {
+                    const IORequest &req = batch[first + i];
+                    unsigned idx = tail & sq_mask;
+                    io_uring_sqe *sqe = &sqes[idx];
+                    memset(sqe, 0, sizeof(*sqe));
+                    sqe->fd = fds[req.disk];
+                    if (req.iov)
+                    {
+                        sqe->opcode = req.write ? IORING_OP_WRITEV : IORING_OP_READV;
+                        sqe->addr = (unsigned long)req.iov;
+                        sqe->len = req.iovcnt;
+                    }
+                    else
+                    {
+                        sqe->opcode = req.write ? IORING_OP_WRITE : IORING_OP_READ;
+                        sqe->addr = (unsigned long)req.buf;
+                        sqe->len = req.len;
+                    }
+                    sqe->off = req.pos;
+                    sqe->user_data = first + i;
+                    sq_array[idx] = idx;
+                    tail++;
+                }
+                __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+                size_t submitted = 0, completed = 0;
+                while (completed < count)
+                {
+                    unsigned to_submit = count - submitted;
+                    int ret = syscall(__NR_io_uring_enter, ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                    if (ret < 0)
+                    {
+                        if (errno == EINTR)
+                            continue;
+                        std::cerr << "Error: io_uring_enter failed" << std::endl;
+                        return -1;
+                    }
+                    submitted += ret;
+                    unsigned head = *cq_head;
+                    while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+                    {
+                        io_uring_cqe *cqe = &cqes[head & cq_mask];
+                        if (finish(fds, batch[cqe->user_data], cqe->res))
+                            status = -1;
+                        head++;
+                        completed++;
+                    }
+                    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+                }
+            }
+            return status;
+        }
+
+    private:
+        int ring_fd = -1;
+        unsigned depth = 0;
+        char *sq_ptr = nullptr, *cq_ptr = nullptr;
+        size_t sq_size = 0, cq_size = 0, sqes_size = 0;
+        io_uring_sqe *sqes = nullptr;
+        unsigned *sq_tail, *sq_array, *cq_head, *cq_tail;
+        unsigned sq_mask, cq_mask;
+        io_uring_cqe *cqes;
+
+        char *map_ring(size_t size, off_t offset)
+        {
+            void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+            return ptr == MAP_FAILED ? nullptr : (char *)ptr;
+        }
+
+        // check a completion, short transfers are finished synchronously
+        int finish(const std::vector<int> &fds, const IORequest &req, int res)
+        {
+            if (res < 0)
+            {
+                std::cerr << "Error: failed to " << (req.write ? "write" : "read") << " disk" << std::endl;
+                return -1;
+            }
+            if ((size_t)res == req.len)
+                return 0;
+            if (req.iov)
+                return transfer_vector(fds[req.disk], req, res);
+            IORequest rest = req;
+            rest.pos += res;
+            rest.buf += res;
+            rest.len -= res;
+            return run_request(fds[req.disk], rest);
+        }
+    };
+
+    // io_uring, every batch is one submission. Each thread submitting takes a
+    // ring of its own from a free list, so the batches of different threads
+    // never wait for each other; a ring is set up whenever all are in use.
+    class UringEngine : public IOEngine
+    {
+    public:
+        UringEngine(unsigned queue_depth) : queue_depth(queue_depth) {}
+
+        const char *name() override
+        {
+            return "io_uring";
+        }
+
+        // false when the kernel does not offer io_uring
+        bool setup()
+        {
+            std::unique_ptr<UringRing> ring = acquire();
+            if (!ring)
+                return false;
+            release(std::move(ring));
+            return true;
+        }
+
+        int submit(const std::vector<int> &fds, std::vector<IORequest> &batch) override
+        {
+            std::unique_ptr<UringRing> ring = acquire();
+            if (!ring)
+            {
+                // out of rings, e.g. at the memlock limit: the batch runs synchronously
+                for (auto &req : batch)
+                {
+                    if (run_request(fds[req.disk], req))
+                        return -1;
+                }
+                return 0;
+            }
+            int status = ring->submit(fds, batch);
+            release(std::move(ring));
+            return status;
+        }
+
+    private:
+        unsigned queue_depth;
+        // rings not in use, the mutex guards only the list
+        std::vector<std::unique_ptr<UringRing>> idle;
+        std::mutex mutex;
+
+        std::unique_ptr<UringRing> acquire()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!idle.empty())
+                {
+                    std::unique_ptr<UringRing> ring = std::move(idle.back());
+                    idle.pop_back();
+                    return ring;
+                }
+            }
+            auto ring = std::make_unique<UringRing>();
+            if (!ring->setup(queue_depth))
+                return nullptr;
+            return ring;
+        }
+
+        void release(std::unique_ptr<UringRing> ring)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            idle.push_back(std::move(ring));
+        }
+    };
+
+    inline IOEngine *make_io_engine(IOMode mode, int queue_depth)
+    {
+        if (mode == IO_URING)
+        {
+            auto engine = new UringEngine(queue_depth);
+            if (engine->setup())
+                return engine;
+            delete engine;
+            // fall back to the thread pool
+            mode = IO_THREADS;
+        }
+        if (mode == IO_THREADS)
+            return new ThreadPoolEngine(queue_depth);
+        return new SyncEngine();
+    }
+}
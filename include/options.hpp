@@ -0,0 +1,55 @@
+#pragma once
+
+namespace RAID6
+{
+    // when writes to the disk files are made durable
+    enum SyncPolicy
+    {
+        SYNC_NONE, // left to the OS, call sync() for a durability point
+        SYNC_DATA, // fdatasync (msync for mapped disks) after every write
+        SYNC_FULL, // fsync after every write
+    };
+
+    enum Backend
+    {
+        BACKEND_FILE,   // persistent descriptors with pread/pwrite
+        BACKEND_MMAP,   // every disk file mapped shared into memory
+        BACKEND_STREAM, // an fstream opened per call
+    };
+
+    // how the file backend runs the batch of member disk I/O of a stripe
+    enum IOMode
+    {
+        IO_SYNC,    // one request after another on the calling thread
+        IO_URING,   // one io_uring submission per batch, thread pool if io_uring is unavailable
+        IO_THREADS, // requests spread over a thread pool
+    };
+
+    struct Options
+    {
+        SyncPolicy sync = SYNC_NONE;
+        Backend backend = BACKEND_FILE;
+        IOMode io_mode = IO_SYNC;
+        // io_uring entries, or threads of the pool
+        int queue_depth = 32;
+        // open the disk files with O_DIRECT, block_size must be a multiple of the logical sector
+        bool direct_io = false;
+        // rows held by the write-back stripe cache, 0 writes through
+        int cache_stripes = 0;
+        // cached changes older than this are written back on the next put, 0 waits for flush()
+        int cache_flush_ms = 0;
+        // CRC32C of every block in a sidecar file per disk, verified on get
+        bool checksums = false;
+        // write-intent bitmap for a resync of only the rows a crash left half written
+        bool write_intent = false;
+        // rows per bitmap bit, fixed when the bitmap is created
+        int intent_region_blocks = 64;
+        // workers running async_get/async_put/async_recover, 0 for queue_depth
+        int async_threads = 0;
+        // bytes of each disk in a stripe, parity rotates from one stripe to the
+        // next; a multiple of block_size, 0 for block_size, fixed when created
+        int chunk_size = 0;
+        // reserve the space of new disk files with fallocate, otherwise they are sparse
+        bool preallocate = false;
+    };
+}
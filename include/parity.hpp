@@ -3,6 +3,10 @@
 #include <vector>
 #include <fstream>
 #include <cassert>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include "gf_kernels.hpp"
 
 using std::cerr;
 using std::cout;
@@ -13,112 +17,327 @@ using std::vector;
 
 namespace RAID6
 {
-    class Parity
+    // parity policies, index is the parity slot in a stripe (P = 0, Q = 1)
+    struct PolicyXOR
     {
-    public:
-        Parity(int num_disks)
+        static constexpr int index = 0;
+    };
+    struct PolicyRS
+    {
+        static constexpr int index = 1;
+    };
+
+    // GF(2^8) primitive polynomial for RAID-like systems
+    constexpr unsigned char GF_2_8_POLY = 0x1D;
+
+    // Precomputed GF(2^8) tables, shared read-only by every Parity
+    struct GFTables
+    {
+        unsigned char mul[256][256];
+        // exp[i] = g^i with g = 0x02, doubled so exp[log a + log b] needs no modulo
+        unsigned char exp[512];
+        unsigned char log[256];
+        unsigned char inv[256];
+        // split-nibble tables for the block kernels, see gf_kernels.hpp
+        unsigned char nibble[256][32];
+    };
+
+    constexpr GFTables generate_gf_tables()
+    {
+        GFTables t{};
+        unsigned int x = 1;
+        for (int i = 0; i < 255; ++i)
         {
-            generate_gf_tables();
-            rs_coefficients[0] = 0x01;
-            for(int i=1;i<256;++i)
+            t.exp[i] = x;
+            t.exp[i + 255] = x;
+            t.log[x] = i;
+            x <<= 1;
+            if (x & 0x100)
             {
-                rs_coefficients[i] = gf_multiply(0x02,rs_coefficients[i-1]);
+                x ^= 0x100 | GF_2_8_POLY;
             }
         }
-        
-        inline void XOR_block(char* a, char* b, size_t len, char* result)
+        t.exp[510] = t.exp[0];
+        t.exp[511] = t.exp[1];
+        for (int a = 1; a < 256; ++a)
         {
-            for (int i = 0; i < len; i++)
+            for (int b = 1; b < 256; ++b)
             {
-                result[i] = a[i] ^ b[i];
+                t.mul[a][b] = t.exp[t.log[a] + t.log[b]];
             }
+            t.inv[a] = t.exp[255 - t.log[a]];
         }
-        // Function to multiply using the precomputed tables
-        inline unsigned char gf_multiply(unsigned char a, unsigned char b)
+        for (int c = 0; c < 256; ++c)
         {
-            return gf_table[a][b];
+            for (int x = 0; x < 16; ++x)
+            {
+                t.nibble[c][x] = t.mul[c][x];
+                t.nibble[c][16 + x] = t.mul[c][x << 4];
+            }
         }
-        inline char gf_inverse(char a)
+        return t;
+    }
+
+    inline constexpr GFTables gf_tables = generate_gf_tables();
+
+    // where the syndromes of a row put a single bad block, data blocks are 0 and up
+    enum ErrorLocation
+    {
+        LOCATION_NONE = -1,    // the row is consistent
+        LOCATION_P = -2,       // only P disagrees
+        LOCATION_Q = -3,       // only Q disagrees
+        LOCATION_UNKNOWN = -4, // more than one block is bad
+    };
+
+    // P and Q of a row a cache block at a time, so every data byte is loaded once
+    inline void blocked_gen_syndrome(const GFKernel &kernel, size_t step, size_t len, int ndata, char *const *data, char *P, char *Q)
+    {
+        char *blocks[256];
+        for (size_t offset = 0; offset < len; offset += step)
         {
-            if (a == 0)
+            size_t n = std::min(step, len - offset);
+            for (int i = 0; i < ndata; ++i)
             {
-                return 0;
+                blocks[i] = data[i] + offset;
             }
-            int res=a;
-            for(int i=0;i<253;++i)
+            kernel.gen_syndrome(n, ndata, blocks, P + offset, Q + offset);
+        }
+    }
+
+    // the kernel and gen_syndrome step measured fastest on this CPU
+    struct ParityTuning
+    {
+        const GFKernel *kernel;
+        size_t syndrome_block;
+    };
+
+    // Times gen_syndrome of a row of 8 blocks of 128 KiB, best of 3, with every
+    // kernel and then with the chosen one at each step. A few ms.
+    inline ParityTuning tune_parity()
+    {
+        const int ndata = 8;
+        const size_t len = 128 * 1024;
+        vector<char> buf((ndata + 2) * len);
+        for (size_t i = 0; i < buf.size(); ++i)
+        {
+            buf[i] = i * 131 + (i >> 9);
+        }
+        char *data[ndata];
+        for (int i = 0; i < ndata; ++i)
+        {
+            data[i] = buf.data() + i * len;
+        }
+        char *P = buf.data() + ndata * len, *Q = P + len;
+        auto measure = [&](const GFKernel &kernel, size_t step)
+        {
+            double best = 1e30;
+            for (int rep = 0; rep < 3; ++rep)
             {
-                res = gf_multiply(res,a);
+                auto start = std::chrono::steady_clock::now();
+                blocked_gen_syndrome(kernel, step, len, ndata, data, P, Q);
+                best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            }
+            return best;
+        };
+        // a candidate replaces the widest kernel and the default step only when
+        // clearly faster, so noise does not move the choice between runs
+        const double margin = 0.95;
+        ParityTuning tuning = {&kernels::best(), 16384};
+        double best = measure(*tuning.kernel, tuning.syndrome_block);
+        for (const GFKernel *kernel : kernels::available())
+        {
+            double t = measure(*kernel, tuning.syndrome_block);
+            if (t < best * margin)
+            {
+                best = t;
+                tuning.kernel = kernel;
             }
-            return res;
         }
-        inline void gf_multiply_byte_block(char* a, char b, size_t len, char* result)
+        best = measure(*tuning.kernel, tuning.syndrome_block);
+        for (size_t step = 4096; step <= len; step *= 2)
         {
-            for (int i = 0; i < len; i++)
+            double t = measure(*tuning.kernel, step);
+            if (t < best * margin)
             {
-                result[i] = gf_multiply(a[i], b);
+                best = t;
+                tuning.syndrome_block = step;
             }
         }
+        return tuning;
+    }
+
+    // tuned on first use, once per process
+    inline const ParityTuning &tuned_parity()
+    {
+        static const ParityTuning tuning = tune_parity();
+        return tuning;
+    }
+
+    class Parity
+    {
+    public:
+        Parity(int num_disks)
+        {
+            const ParityTuning &tuning = tuned_parity();
+            kernel = tuning.kernel;
+            syndrome_block = tuning.syndrome_block;
+        }
+
+        // select the block kernel, e.g. kernels::scalar() for reference results
+        void set_kernel(const GFKernel &k)
+        {
+            kernel = &k;
+        }
+        const GFKernel &get_kernel()
+        {
+            return *kernel;
+        }
+        
+        inline void XOR_block(char* a, char* b, size_t len, char* result)
+        {
+            kernel->xor_block(a, b, len, result);
+        }
+        // Function to multiply using the precomputed tables
+        inline unsigned char gf_multiply(unsigned char a, unsigned char b)
+        {
+            return gf_tables.mul[a][b];
+        }
+        inline char gf_inverse(char a)
+        {
+            return gf_tables.inv[(unsigned char)a];
+        }
+        inline void gf_multiply_byte_block(char* a, char b, size_t len, char* result)
+        {
+            kernel->mul_block(a, gf_tables.nibble[(unsigned char)b], len, result);
+        }
         unsigned char gf_pow_02(int n)
         {
-            while (n < 0)
+            n %= 255;
+            if (n < 0)
             {
                 n += 255;
             }
-            n %= 255;
-            return rs_coefficients[n];
+            return gf_tables.exp[n];
         }
-        void cal_XOR_parity(size_t block_size, vector<char *> data, char *parity)
+        void cal_XOR_parity(size_t block_size, const vector<char *> &data, char *parity)
         {
             assert(data.size() > 0);
-            memset(parity, 0, block_size);
-            for (int i = 0; i < data.size(); i++)
+            memcpy(parity, data[0], block_size);
+            for (int i = 1; i < data.size(); i++)
             {
-                for (int j = 0; j < block_size; j++)
-                {
-                    parity[j] ^= data[i][j];
-                }
+                kernel->xor_block(parity, data[i], block_size, parity);
             }
         }
-        void update_XOR_parity(size_t len, char *old_data, char *new_data, char *parity)
+        void update_XOR_parity(size_t len, const char *old_data, const char *new_data, char *parity)
         {
-            for (int byte = 0; byte < len; ++byte)
-            {
-                parity[byte] ^= (old_data[byte] ^ new_data[byte]);
-            }
+            kernel->xor_block(parity, old_data, len, parity);
+            kernel->xor_block(parity, new_data, len, parity);
         }
 
-        void cal_RS_parity(size_t len, vector<char *> data, char *parity) {
+        void cal_RS_parity(size_t len, const vector<char *> &data, char *parity) {
             memset(parity, 0, len);
-            for (int byte = 0; byte < len; ++byte)
+            for (int i = 0; i < data.size(); i++)
             {
-                for (int i = 0; i < data.size(); i++)
-                {
-                    int coeff = rs_coefficients[i];
-                    unsigned char contribution = gf_multiply(coeff, data[i][byte]);
-                    parity[byte] ^= contribution;
-                }
+                kernel->mul_xor_block(data[i], gf_tables.nibble[gf_tables.exp[i]], len, parity);
             }
         }
 
-        void update_RS_parity(size_t len, char *old_data, char *new_data, char *parity, int rs_index = 0)
+        void update_RS_parity(size_t len, const char *old_data, const char *new_data, char *parity, int rs_index = 0)
+        {
+            // g^i * old + g^i * new == g^i * (old + new)
+            const unsigned char *tbl = gf_tables.nibble[gf_tables.exp[rs_index]];
+            kernel->mul_xor_block(old_data, tbl, len, parity);
+            kernel->mul_xor_block(new_data, tbl, len, parity);
+        }
+
+        // calculate P and Q for a row of data blocks in a single pass,
+        // walking the row one cache block at a time so every data byte is loaded once
+        void gen_syndrome(size_t len, const vector<char *> &data, char *P, char *Q)
+        {
+            assert(data.size() > 0 && data.size() <= 255);
+            blocked_gen_syndrome(*kernel, syndrome_block, len, data.size(), data.data(), P, Q);
+        }
+        void set_syndrome_block(size_t bytes)
         {
-            int coeff = rs_coefficients[rs_index];
-            for (int byte = 0; byte < len; ++byte)
+            syndrome_block = bytes;
+        }
+        size_t get_syndrome_block()
+        {
+            return syndrome_block;
+        }
+
+        // Data block x of a row from Q, data holds the row with block x zero.
+        // D_x = (Q + Q_x) * g^(-x), Q_x the Q of data.
+        void decode_data_q(size_t len, const vector<char *> &data, int x, const char *Q, char *data_x)
+        {
+            cal_RS_parity(len, data, data_x);
+            kernel->xor_block(Q, data_x, len, data_x);
+            kernel->mul_block(data_x, gf_tables.nibble[gf_pow_02(-x)], len, data_x);
+        }
+
+        // Data blocks x and y of a row from P and Q, data holds the row with both zero.
+        // With P_xy and Q_xy the P and Q of data:
+        // D_x = A * (P + P_xy) + B * (Q + Q_xy), A = g^(y-x) / (g^(y-x) + 1), B = g^(-x) / (g^(y-x) + 1)
+        // D_y = (P + P_xy) + D_x
+        void decode_data_pair(size_t len, const vector<char *> &data, int x, int y, const char *P, const char *Q,
+                              char *data_x, char *data_y)
+        {
+            unsigned char coef_yx = gf_pow_02(y - x);
+            unsigned char inv = gf_inverse(coef_yx ^ 0x01);
+            unsigned char A = gf_multiply(inv, coef_yx);
+            unsigned char B = gf_multiply(inv, gf_pow_02(-x));
+            gen_syndrome(len, data, data_y, data_x);
+            kernel->xor_block(P, data_y, len, data_y);
+            kernel->xor_block(Q, data_x, len, data_x);
+            kernel->mul_block(data_x, gf_tables.nibble[B], len, data_x);
+            kernel->mul_xor_block(data_y, gf_tables.nibble[A], len, data_x);
+            kernel->xor_block(data_y, data_x, len, data_y);
+        }
+
+        // Locate a single bad block of a row from dp = P + P' and dq = Q + Q',
+        // where P' and Q' are computed from the data. A bad data block z gives
+        // dq = g^z * dp at every byte, a bad parity leaves the other syndrome zero.
+        int locate_error(size_t len, const char *dp, const char *dq, int num_data)
+        {
+            bool p_zero = is_zero(dp, len), q_zero = is_zero(dq, len);
+            if (p_zero && q_zero)
+                return LOCATION_NONE;
+            if (q_zero)
+                return LOCATION_P;
+            if (p_zero)
+                return LOCATION_Q;
+            int z = -1;
+            for (size_t i = 0; i < len; ++i)
             {
-                unsigned char old_contribution = gf_multiply(coeff, old_data[0]);
-                unsigned char new_contribution = gf_multiply(coeff, new_data[0]);
-                parity[byte] ^= (old_contribution ^ new_contribution);
+                unsigned char a = dp[i], b = dq[i];
+                if (!a && !b)
+                    continue;
+                if (!a || !b)
+                    return LOCATION_UNKNOWN;
+                int pos = (gf_tables.log[b] - gf_tables.log[a] + 255) % 255;
+                if (z < 0)
+                    z = pos;
+                else if (pos != z)
+                    return LOCATION_UNKNOWN;
             }
+            return z < num_data ? z : LOCATION_UNKNOWN;
+        }
+
+        static bool is_zero(const char *block, size_t len)
+        {
+            // a zero first byte equal to the block shifted by one means all zero
+            return len == 0 || (block[0] == 0 && memcmp(block, block + 1, len - 1) == 0);
         }
 
         // calculate parity for a row of data blocks
-        void calculate_parity(string policy, size_t len, vector<char *> data, char *parity)
+        template <typename Policy>
+        void calculate(size_t len, const vector<char *> &data, char *parity)
         {
-            if (policy == "XOR")
+            if constexpr (Policy::index == PolicyXOR::index)
             {
                 cal_XOR_parity(len, data, parity);
             }
-            else if (policy == "RS")
+            else
             {
                 cal_RS_parity(len, data, parity);
             }
@@ -126,60 +345,23 @@ namespace RAID6
 
         // update parity block when a data block is updated
         // rs_index is the data block index in the row
-        void update_block_parity(string policy, size_t len, char *old_data, char *new_data, char *parity, int rs_index = 0)
+        template <typename Policy>
+        void update(size_t len, const char *old_data, const char *new_data, char *parity, int rs_index = 0)
         {
-            if (policy == "XOR")
+            if constexpr (Policy::index == PolicyXOR::index)
             {
                 update_XOR_parity(len, old_data, new_data, parity);
             }
-            else if (policy == "RS")
+            else
             {
                 update_RS_parity(len, old_data, new_data, parity, rs_index);
             }
         }
 
     private:
-        // GF(2^8) primitive polynomial for RAID-like systems
-        const unsigned char GF_2_8_POLY = 0x1D;
-
-        // Precomputed multiplication tables for GF(2^8)
-        unsigned char gf_table[256][256];
-
-        int rs_coefficients[256];
-
-        // Function to generate precomputed multiplication tables for GF(2^8)
-        void generate_gf_tables()
-        {
-            for (unsigned int x = 0; x < 256; ++x)
-            {
-                for (unsigned int y = 0; y < 256; ++y)
-                {
-                    unsigned char a = x;
-                    unsigned char b = y;
-                    unsigned char product = 0;
-
-                    // Actual GF(2^8) multiplication logic
-                    while (b)
-                    {
-                        if (b & 1)
-                        {
-                            product ^= a;
-                        }
-                        if (a & 0x80)
-                        {
-                            a = (a << 1) ^ GF_2_8_POLY;
-                        }
-                        else
-                        {
-                            a <<= 1;
-                        }
-                        b >>= 1;
-                    }
-
-                    gf_table[x][y] = product;
-                }
-            }
-        }
+        const GFKernel *kernel;
 
+        // bytes of every data block processed per gen_syndrome step
+        size_t syndrome_block = 16384;
     };
 }
@@ -0,0 +1,60 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace RAID6
+{
+    struct RebuildProgress
+    {
+        int done;  // stripes rebuilt, those of a resumed checkpoint included
+        int total; // num_blocks
+        double elapsed; // seconds since this run started
+        double eta;     // seconds left at the current rate
+        double bytes_per_sec;
+    };
+
+    struct RebuildOptions
+    {
+        // workers, 0 for one per hardware thread
+        int threads = 0;
+        // caps on disk traffic of the rebuild, 0 for none
+        double max_bytes_per_sec = 0;
+        double max_stripes_per_sec = 0;
+        // stripes between checkpoints and progress reports
+        int checkpoint_interval = 256;
+        // called on the calling thread after every checkpoint
+        std::function<void(const RebuildProgress &)> progress;
+    };
+
+    // Paces work to a rate, callers sleep until their share of the budget is due.
+    class Throttle
+    {
+    public:
+        Throttle(double rate) : rate(rate) {}
+
+        void acquire(double amount)
+        {
+            if (rate <= 0)
+                return;
+            auto now = std::chrono::steady_clock::now();
+            std::chrono::steady_clock::time_point start;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                // unused budget is not saved up for bursts
+                start = std::max(now, next);
+                next = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                   std::chrono::duration<double>(amount / rate));
+            }
+            if (start > now)
+                std::this_thread::sleep_until(start);
+        }
+
+    private:
+        double rate;
+        std::chrono::steady_clock::time_point next;
+        std::mutex mutex;
+    };
+}
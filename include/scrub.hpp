@@ -0,0 +1,37 @@
+#pragma once
+#include <vector>
+
+namespace RAID6
+{
+    struct ScrubOptions
+    {
+        // workers, 0 for one per hardware thread
+        int threads = 0;
+        // rewrite a located bad block, otherwise only report it
+        bool repair = true;
+        // cap on the disk traffic of the scrub, 0 for none
+        double max_bytes_per_sec = 0;
+    };
+
+    // a row whose parity did not match its data
+    struct ScrubError
+    {
+        int block;
+        // the bad block, -1 when more than one block of the row is bad
+        int disk;
+        bool repaired;
+    };
+
+    struct ScrubReport
+    {
+        int stripes_scanned = 0;
+        // rows that can not be verified while a disk has failed
+        int stripes_skipped = 0;
+        int repaired = 0;
+        int unrecoverable = 0;
+        // sorted by block
+        std::vector<ScrubError> errors;
+        double elapsed = 0; // seconds
+        double bytes_per_sec = 0;
+    };
+}
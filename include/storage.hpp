@@ -0,0 +1,529 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include "options.hpp"
+#include "io_engine.hpp"
+#include "arena.hpp"
+
+namespace RAID6
+{
+    // byte addressed access to the member disks of an array
+    class Storage
+    {
+    public:
+        Storage(SyncPolicy sync) : sync_policy(sync) {}
+        virtual ~Storage() {}
+
+        // disks that can not be opened are left closed, see is_open()
+        virtual int open(const std::vector<std::string> &disk_paths) = 0;
+        virtual void close() = 0;
+        virtual bool is_open(int disk) = 0;
+        // open one disk again, after its file was replaced
+        virtual int reopen(int disk, const std::string &disk_path) = 0;
+        virtual int read(int disk, off_t pos, size_t len, char *data) = 0;
+        virtual int write(int disk, off_t pos, size_t len, const char *data) = 0;
+        // flush every disk to stable storage
+        virtual int sync() = 0;
+
+        // run a batch of transfers, possibly in parallel; returns once all completed
+        virtual int submit(std::vector<IORequest> &batch)
+        {
+            for (auto &req : batch)
+            {
+                if (req.write ? write(req.disk, req.pos, req.len, req.buf) : read(req.disk, req.pos, req.len, req.buf))
+                    return -1;
+            }
+            return 0;
+        }
+
+        // pointer to the bytes at pos of a disk, nullptr if the backend has no mapping
+        virtual char *map(int /* disk */, off_t /* pos */)
+        {
+            return nullptr;
+        }
+        // apply the sync policy to a range changed through map()
+        virtual int commit(int /* disk */, off_t /* pos */, size_t /* len */)
+        {
+            return 0;
+        }
+
+        // offsets, lengths and buffers aligned to this take the fast path
+        virtual size_t alignment()
+        {
+            return 1;
+        }
+
+    protected:
+        SyncPolicy sync_policy;
+    };
+
+    class FileStorage : public Storage
+    {
+    public:
+        FileStorage(SyncPolicy sync, IOEngine *engine, bool direct_io = false)
+            : Storage(sync), engine(engine), direct_io(direct_io) {}
+        ~FileStorage()
+        {
+            close();
+        }
+
+        int open(const std::vector<std::string> &disk_paths) override
+        {
+            close();
+            dio_align = 1;
+            for (auto &disk_path : disk_paths)
+            {
+                fds.push_back(open_disk(disk_path));
+            }
+            return 0;
+        }
+
+        int reopen(int disk, const std::string &disk_path) override
+        {
+            if (fds[disk] >= 0)
+                ::close(fds[disk]);
+            fds[disk] = open_disk(disk_path);
+            return fds[disk] < 0 ? -1 : 0;
+        }
+
+        void close() override
+        {
+            for (int fd : fds)
+            {
+                if (fd >= 0)
+                    ::close(fd);
+            }
+            fds.clear();
+        }
+
+        bool is_open(int disk) override
+        {
+            return fds[disk] >= 0;
+        }
+
+        int read(int disk, off_t pos, size_t len, char *data) override
+        {
+            if (!aligned(pos, len, data))
+                return bounce({disk, pos, len, data, false});
+            return pread_full(fds[disk], data, len, pos);
+        }
+
+        int write(int disk, off_t pos, size_t len, const char *data) override
+        {
+            if (!aligned(pos, len, data))
+            {
+                if (bounce({disk, pos, len, (char *)data, true}))
+                    return -1;
+            }
+            else if (pwrite_full(fds[disk], data, len, pos))
+                return -1;
+            return sync_disk(disk, sync_policy);
+        }
+
+        int submit(std::vector<IORequest> &batch) override
+        {
+            if (direct_io)
+            {
+                // requests O_DIRECT can not take go through a bounce buffer
+                std::vector<IORequest> direct;
+                for (auto &req : batch)
+                {
+                    if (aligned(req.pos, req.len, req.buf))
+                        direct.push_back(req);
+                    else if (bounce(req))
+                        return -1;
+                }
+                if (submit_coalesced(direct))
+                    return -1;
+            }
+            else if (submit_coalesced(batch))
+                return -1;
+            if (sync_policy != SYNC_NONE)
+            {
+                for (auto &req : batch)
+                {
+                    if (req.write && sync_disk(req.disk, sync_policy))
+                        return -1;
+                }
+            }
+            return 0;
+        }
+
+        const char *engine_name()
+        {
+            return engine->name();
+        }
+
+        size_t alignment() override
+        {
+            return dio_align;
+        }
+
+        int sync() override
+        {
+            for (int disk = 0; disk < (int)fds.size(); ++disk)
+            {
+                if (fds[disk] >= 0 && sync_disk(disk, sync_policy == SYNC_FULL ? SYNC_FULL : SYNC_DATA))
+                    return -1;
+            }
+            return 0;
+        }
+
+    protected:
+        std::vector<int> fds;
+        std::unique_ptr<IOEngine> engine;
+
+        // contiguous requests of a disk as one preadv/pwritev
+        int submit_coalesced(std::vector<IORequest> &batch)
+        {
+            if (batch.size() <= 1)
+                return engine->submit(fds, batch);
+            std::vector<std::vector<iovec>> iovecs;
+            std::vector<IORequest> runs = coalesce(batch, iovecs);
+            return engine->submit(fds, runs);
+        }
+        bool direct_io;
+        size_t dio_align = 1;
+
+        int open_disk(const std::string &disk_path)
+        {
+            int fd = ::open(disk_path.c_str(), O_RDWR | (direct_io ? O_DIRECT : 0));
+            if (fd < 0)
+            {
+                std::cerr << "Error: failed to open disk " << disk_path << std::endl;
+                return -1;
+            }
+            if (direct_io)
+                dio_align = std::max(dio_align, direct_io_alignment(fd));
+            return fd;
+        }
+
+        // the logical sector of the device behind fd
+        static size_t direct_io_alignment(int fd)
+        {
+            struct stat st;
+            if (fstat(fd, &st) == 0 && S_ISBLK(st.st_mode))
+            {
+                int sector = 0;
+                if (ioctl(fd, BLKSSZGET, &sector) == 0 && sector > 0)
+                    return sector;
+            }
+#ifdef STATX_DIOALIGN
+            struct statx stx;
+            if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 && (stx.stx_mask & STATX_DIOALIGN) &&
+                stx.stx_dio_offset_align > 0)
+                return std::max(stx.stx_dio_offset_align, stx.stx_dio_mem_align);
+#endif
+            return 512;
+        }
+
+        bool aligned(off_t pos, size_t len, const char *buf)
+        {
+            return ((pos | len | (uintptr_t)buf) & (dio_align - 1)) == 0;
+        }
+
+        // unaligned access under O_DIRECT: read-modify-write of the covering sectors
+        int bounce(const IORequest &req)
+        {
+            off_t start = req.pos / dio_align * dio_align;
+            off_t end = (req.pos + req.len + dio_align - 1) / dio_align * dio_align;
+            void *mem = nullptr;
+            if (posix_memalign(&mem, std::max(dio_align, (size_t)ARENA_ALIGNMENT), end - start))
+                return -1;
+            char *span = (char *)mem;
+            int status = pread_full(fds[req.disk], span, end - start, start);
+            if (status == 0)
+            {
+                if (req.write)
+                {
+                    memcpy(span + (req.pos - start), req.buf, req.len);
+                    status = pwrite_full(fds[req.disk], span, end - start, start);
+                }
+                else
+                {
+                    memcpy(req.buf, span + (req.pos - start), req.len);
+                }
+            }
+            free(mem);
+            return status;
+        }
+
+        int sync_disk(int disk, SyncPolicy policy)
+        {
+            if ((policy == SYNC_DATA && fdatasync(fds[disk])) ||
+                (policy == SYNC_FULL && fsync(fds[disk])))
+            {
+                std::cerr << "Error: failed to sync disk" << std::endl;
+                return -1;
+            }
+            return 0;
+        }
+    };
+
+    // Parity updates and rebuilds work on the mapped pages through map(),
+    // durability comes from msync according to the sync policy or sync().
+    class MmapStorage : public Storage
+    {
+    public:
+        MmapStorage(SyncPolicy sync) : Storage(sync) {}
+        ~MmapStorage()
+        {
+            close();
+        }
+
+        int open(const std::vector<std::string> &disk_paths) override
+        {
+            close();
+            maps.assign(disk_paths.size(), nullptr);
+            sizes.assign(disk_paths.size(), -1);
+            for (int disk = 0; disk < (int)disk_paths.size(); ++disk)
+            {
+                if (map_disk(disk, disk_paths[disk]) == 1)
+                    return -1;
+            }
+            return 0;
+        }
+
+        int reopen(int disk, const std::string &disk_path) override
+        {
+            if (maps[disk])
+                munmap(maps[disk], sizes[disk]);
+            maps[disk] = nullptr;
+            sizes[disk] = -1;
+            return map_disk(disk, disk_path) ? -1 : 0;
+        }
+
+        void close() override
+        {
+            for (int disk = 0; disk < (int)maps.size(); ++disk)
+            {
+                if (maps[disk])
+                    munmap(maps[disk], sizes[disk]);
+            }
+            maps.clear();
+            sizes.clear();
+        }
+
+        bool is_open(int disk) override
+        {
+            return sizes[disk] >= 0;
+        }
+
+        int read(int disk, off_t pos, size_t len, char *data) override
+        {
+            if (!in_range(disk, pos, len))
+                return -1;
+            memcpy(data, maps[disk] + pos, len);
+            return 0;
+        }
+
+        int write(int disk, off_t pos, size_t len, const char *data) override
+        {
+            if (!in_range(disk, pos, len))
+                return -1;
+            memcpy(maps[disk] + pos, data, len);
+            return commit(disk, pos, len);
+        }
+
+        int sync() override
+        {
+            for (int disk = 0; disk < (int)maps.size(); ++disk)
+            {
+                if (maps[disk] && msync(maps[disk], sizes[disk], MS_SYNC))
+                {
+                    std::cerr << "Error: failed to sync disk" << std::endl;
+                    return -1;
+                }
+            }
+            return 0;
+        }
+
+        char *map(int disk, off_t pos) override
+        {
+            if (pos >= sizes[disk])
+                return nullptr;
+            return maps[disk] + pos;
+        }
+
+        int commit(int disk, off_t pos, size_t len) override
+        {
+            if (sync_policy == SYNC_NONE)
+                return 0;
+            // msync wants a page aligned start
+            off_t page = sysconf(_SC_PAGESIZE);
+            off_t start = pos / page * page;
+            if (msync(maps[disk] + start, pos + len - start, MS_SYNC))
+            {
+                std::cerr << "Error: failed to sync disk" << std::endl;
+                return -1;
+            }
+            return 0;
+        }
+
+    private:
+        std::vector<char *> maps;
+        // a size of -1 marks a disk that could not be opened
+        std::vector<off_t> sizes;
+
+        // 0 when mapped, -1 when the disk can not be opened, 1 when mapping fails
+        int map_disk(int disk, const std::string &disk_path)
+        {
+            int fd = ::open(disk_path.c_str(), O_RDWR);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st))
+            {
+                std::cerr << "Error: failed to open disk " << disk_path << std::endl;
+                if (fd >= 0)
+                    ::close(fd);
+                return -1;
+            }
+            char *addr = nullptr;
+            if (st.st_size > 0)
+            {
+                void *m = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (m == MAP_FAILED)
+                {
+                    std::cerr << "Error: failed to map disk" << std::endl;
+                    ::close(fd);
+                    return 1;
+                }
+                addr = (char *)m;
+            }
+            // the mapping stays valid after the descriptor is closed
+            ::close(fd);
+            maps[disk] = addr;
+            sizes[disk] = st.st_size;
+            return 0;
+        }
+
+        bool in_range(int disk, off_t pos, size_t len)
+        {
+            if (pos + (off_t)len > sizes[disk])
+            {
+                std::cerr << "Error: access beyond the end of disk" << std::endl;
+                return false;
+            }
+            return true;
+        }
+    };
+
+    // the original access path, kept for comparison
+    class StreamStorage : public Storage
+    {
+    public:
+        StreamStorage(SyncPolicy sync) : Storage(sync) {}
+
+        int open(const std::vector<std::string> &disk_paths) override
+        {
+            paths = disk_paths;
+            opened.clear();
+            for (auto &disk_path : paths)
+            {
+                bool exists = access(disk_path.c_str(), R_OK | W_OK) == 0;
+                if (!exists)
+                    std::cerr << "Error: failed to open disk " << disk_path << std::endl;
+                opened.push_back(exists);
+            }
+            return 0;
+        }
+
+        void close() override
+        {
+            paths.clear();
+            opened.clear();
+        }
+
+        bool is_open(int disk) override
+        {
+            return opened[disk];
+        }
+
+        int reopen(int disk, const std::string &disk_path) override
+        {
+            paths[disk] = disk_path;
+            opened[disk] = access(disk_path.c_str(), R_OK | W_OK) == 0;
+            return opened[disk] ? 0 : -1;
+        }
+
+        int read(int disk, off_t pos, size_t len, char *data) override
+        {
+            std::fstream file(paths[disk], std::ios::in | std::ios::out | std::ios::binary);
+            if (!file.is_open())
+            {
+                std::cerr << "Error: failed to open disk" << std::endl;
+                return -1;
+            }
+            file.seekg(pos);
+            file.read(data, len);
+            file.close();
+            return 0;
+        }
+
+        int write(int disk, off_t pos, size_t len, const char *data) override
+        {
+            std::fstream file(paths[disk], std::ios::in | std::ios::out | std::ios::binary);
+            if (!file.is_open())
+            {
+                std::cerr << "Error: failed to open disk" << std::endl;
+                return -1;
+            }
+            file.seekp(pos);
+            file.write(data, len);
+            file.close();
+            if (sync_policy != SYNC_NONE)
+                return sync_path(paths[disk]);
+            return 0;
+        }
+
+        int sync() override
+        {
+            for (int disk = 0; disk < (int)paths.size(); ++disk)
+            {
+                if (opened[disk] && sync_path(paths[disk]))
+                    return -1;
+            }
+            return 0;
+        }
+
+    private:
+        std::vector<std::string> paths;
+        std::vector<bool> opened;
+
+        int sync_path(const std::string &disk_path)
+        {
+            int fd = ::open(disk_path.c_str(), O_RDWR);
+            if (fd < 0 || fsync(fd))
+            {
+                std::cerr << "Error: failed to sync disk" << std::endl;
+                if (fd >= 0)
+                    ::close(fd);
+                return -1;
+            }
+            ::close(fd);
+            return 0;
+        }
+    };
+
+    inline Storage *make_storage(const Options &options)
+    {
+        switch (options.backend)
+        {
+        case BACKEND_MMAP:
+            return new MmapStorage(options.sync);
+        case BACKEND_STREAM:
+            return new StreamStorage(options.sync);
+        default:
+            return new FileStorage(options.sync, make_io_engine(options.io_mode, options.queue_depth), options.direct_io);
+        }
+    }
+}
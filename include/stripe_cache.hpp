@@ -0,0 +1,176 @@
+#pragma once
+#include <chrono>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include "arena.hpp"
+
+namespace RAID6
+{
+    // the cached data blocks of one row
+    struct CachedStripe
+    {
+        int block;
+        // arena buffer per data index, nullptr when that block is not cached
+        std::vector<char *> data;
+        // data blocks newer than the disks
+        std::vector<bool> dirty;
+        int num_dirty = 0;
+        // when the oldest unwritten change was made
+        std::chrono::steady_clock::time_point dirty_since;
+        std::list<int>::iterator lru;
+    };
+
+    // LRU of rows held in arena buffers. Only bookkeeping lives here,
+    // RAID6 decides when rows are filled and written back. Not thread-safe:
+    // RAID6 guards the map, LRU and dirty state with one mutex and the
+    // block contents with the row locks.
+    class StripeCache
+    {
+    public:
+        StripeCache(BlockArena &arena, int num_data, int capacity, int flush_age_ms)
+            : arena(arena), num_data(num_data), capacity(capacity), flush_age(flush_age_ms) {}
+
+        ~StripeCache()
+        {
+            for (auto &entry : entries)
+            {
+                release(entry.second);
+            }
+        }
+
+        // the cached row, moved to the most recently used end
+        CachedStripe *find(int block)
+        {
+            auto it = entries.find(block);
+            if (it == entries.end())
+                return nullptr;
+            lru.splice(lru.begin(), lru, it->second.lru);
+            return &it->second;
+        }
+
+        // the cached row, LRU order untouched
+        CachedStripe *peek(int block)
+        {
+            auto it = entries.find(block);
+            return it == entries.end() ? nullptr : &it->second;
+        }
+
+        CachedStripe *insert(int block)
+        {
+            CachedStripe &stripe = entries[block];
+            stripe.block = block;
+            stripe.data.assign(num_data, nullptr);
+            stripe.dirty.assign(num_data, false);
+            lru.push_front(block);
+            stripe.lru = lru.begin();
+            return &stripe;
+        }
+
+        void erase(int block)
+        {
+            auto it = entries.find(block);
+            if (it == entries.end())
+                return;
+            release(it->second);
+            lru.erase(it->second.lru);
+            entries.erase(it);
+        }
+
+        // rows are inserted first and evicted after, by whoever can lock the victim
+        bool over_capacity()
+        {
+            return (int)entries.size() > capacity;
+        }
+
+        // the row to evict next
+        int victim()
+        {
+            return lru.back();
+        }
+
+        char *buffer(CachedStripe *stripe, int index)
+        {
+            if (!stripe->data[index])
+                stripe->data[index] = arena.acquire();
+            return stripe->data[index];
+        }
+
+        // forget one block of the row
+        void drop(CachedStripe *stripe, int index)
+        {
+            mark_clean(stripe, index);
+            if (stripe->data[index])
+                arena.release(stripe->data[index]);
+            stripe->data[index] = nullptr;
+        }
+
+        void mark_dirty(CachedStripe *stripe, int index)
+        {
+            if (stripe->dirty[index])
+                return;
+            if (stripe->num_dirty == 0)
+                stripe->dirty_since = std::chrono::steady_clock::now();
+            stripe->dirty[index] = true;
+            stripe->num_dirty++;
+        }
+
+        void mark_clean(CachedStripe *stripe, int index)
+        {
+            if (!stripe->dirty[index])
+                return;
+            stripe->dirty[index] = false;
+            stripe->num_dirty--;
+        }
+
+        // rows with changes not written back
+        std::vector<int> dirty_blocks()
+        {
+            std::vector<int> blocks;
+            for (auto &entry : entries)
+            {
+                if (entry.second.num_dirty > 0)
+                    blocks.push_back(entry.first);
+            }
+            return blocks;
+        }
+
+        // Rows whose changes are older than the flush age. The scan runs at most
+        // every half flush age, so a change waits up to 1.5 times the age.
+        std::vector<int> expired_blocks()
+        {
+            std::vector<int> blocks;
+            if (flush_age.count() <= 0)
+                return blocks;
+            auto now = std::chrono::steady_clock::now();
+            if (now < next_scan)
+                return blocks;
+            next_scan = now + flush_age / 2;
+            for (auto &entry : entries)
+            {
+                if (entry.second.num_dirty > 0 && now - entry.second.dirty_since >= flush_age)
+                    blocks.push_back(entry.first);
+            }
+            return blocks;
+        }
+
+    private:
+        BlockArena &arena;
+        int num_data;
+        int capacity;
+        std::chrono::milliseconds flush_age;
+        std::chrono::steady_clock::time_point next_scan;
+        std::unordered_map<int, CachedStripe> entries;
+        // most recently used first
+        std::list<int> lru;
+
+        void release(CachedStripe &stripe)
+        {
+            for (char *buf : stripe.data)
+            {
+                if (buf)
+                    arena.release(buf);
+            }
+        }
+    };
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <algorithm>
+#include <shared_mutex>
+#include <vector>
+
+namespace RAID6
+{
+    // Reader-writer locks for rows, a fixed table the rows hash onto.
+    // Readers of a row share its lock, a parity update holds it alone.
+    // A thread holds one row lock at a time, or several through RowLocks,
+    // which takes them in slot order, so no two threads wait on each other.
+    class StripeLockTable
+    {
+    public:
+        StripeLockTable(int size) : locks(size) {}
+
+        std::shared_mutex &get(int block)
+        {
+            return locks[slot(block)];
+        }
+
+        int slot(int block)
+        {
+            return (unsigned)block % locks.size();
+        }
+
+        std::shared_mutex &at(int slot)
+        {
+            return locks[slot];
+        }
+
+    private:
+        std::vector<std::shared_mutex> locks;
+    };
+
+    using ReadLock = std::shared_lock<std::shared_mutex>;
+    using WriteLock = std::unique_lock<std::shared_mutex>;
+
+    // the locks of several rows, each slot taken once and in ascending order
+    class RowLocks
+    {
+    public:
+        RowLocks(StripeLockTable &table, const std::vector<int> &blocks, bool exclusive) : table(table), exclusive(exclusive)
+        {
+            for (int block : blocks)
+            {
+                slots.push_back(table.slot(block));
+            }
+            std::sort(slots.begin(), slots.end());
+            slots.erase(std::unique(slots.begin(), slots.end()), slots.end());
+            for (int slot : slots)
+            {
+                if (exclusive)
+                    table.at(slot).lock();
+                else
+                    table.at(slot).lock_shared();
+            }
+        }
+        RowLocks(const RowLocks &) = delete;
+        RowLocks &operator=(const RowLocks &) = delete;
+
+        ~RowLocks()
+        {
+            for (auto it = slots.rbegin(); it != slots.rend(); ++it)
+            {
+                if (exclusive)
+                    table.at(*it).unlock();
+                else
+                    table.at(*it).unlock_shared();
+            }
+        }
+
+    private:
+        StripeLockTable &table;
+        bool exclusive;
+        std::vector<int> slots;
+    };
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include "checksum.hpp"
+
+namespace RAID6
+{
+    constexpr uint32_t SUPERBLOCK_MAGIC = 0x36444152; // "RAD6"
+    constexpr uint32_t SUPERBLOCK_VERSION = 1;
+    // bytes at the head of every disk before its first block, aligned for direct I/O
+    constexpr size_t SUPERBLOCK_SIZE = 4096;
+
+    // where P and Q of a row are, see the table in RAID6.hpp
+    enum Layout
+    {
+        LAYOUT_ROTATING, // P and Q move one disk left every stripe
+    };
+
+    // The array metadata, one copy at the head of every member disk. An update
+    // writes every copy with the generation bumped; a copy a crash left half
+    // written fails its checksum, so the newest valid copy is the array.
+    struct Superblock
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t generation;
+        uint32_t num_disks;
+        uint32_t num_blocks;
+        uint32_t block_size;
+        uint32_t chunk_size;
+        uint32_t layout;
+        // the member holding this copy
+        uint32_t disk;
+        // CRC32C of the fields before it
+        uint32_t checksum;
+
+        void seal()
+        {
+            checksum = crc32c((const char *)this, offsetof(Superblock, checksum));
+        }
+
+        bool is_valid() const
+        {
+            return magic == SUPERBLOCK_MAGIC && version == SUPERBLOCK_VERSION &&
+                   checksum == crc32c((const char *)this, offsetof(Superblock, checksum));
+        }
+
+        // the copy of a disk file, false when it is missing or damaged
+        bool read(const std::string &disk_path)
+        {
+            int fd = ::open(disk_path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
+            bool loaded = pread(fd, this, sizeof(*this), 0) == sizeof(*this);
+            ::close(fd);
+            return loaded && is_valid();
+        }
+    };
+    static_assert(std::is_trivially_copyable<Superblock>::value && sizeof(Superblock) <= SUPERBLOCK_SIZE);
+}
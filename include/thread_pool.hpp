@@ -0,0 +1,107 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace RAID6
+{
+    class ThreadPool
+    {
+    public:
+        ThreadPool(int num_threads)
+        {
+            if (num_threads < 1)
+                num_threads = 1;
+            for (int i = 0; i < num_threads; ++i)
+            {
+                workers.emplace_back([this]()
+                                     { run(); });
+            }
+        }
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            cv.notify_all();
+            for (auto &worker : workers)
+            {
+                worker.join();
+            }
+        }
+
+        void push(std::function<void()> task)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                tasks.push_back(std::move(task));
+            }
+            cv.notify_one();
+        }
+
+        int size()
+        {
+            return workers.size();
+        }
+
+    private:
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool stop = false;
+
+        void run()
+        {
+            while (true)
+            {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [this]()
+                            { return stop || !tasks.empty(); });
+                    if (tasks.empty())
+                        return;
+                    task = std::move(tasks.front());
+                    tasks.pop_front();
+                }
+                task();
+            }
+        }
+    };
+
+    // counts outstanding tasks, wait() returns once all of them called done()
+    class Completion
+    {
+    public:
+        Completion(int count) : remaining(count) {}
+
+        void done(int status)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (status)
+                this->status = status;
+            if (--remaining == 0)
+                cv.notify_all();
+        }
+
+        int wait()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this]()
+                    { return remaining == 0; });
+            return status;
+        }
+
+    private:
+        std::mutex mutex;
+        std::condition_variable cv;
+        int remaining;
+        int status = 0;
+    };
+}